@@ -0,0 +1,588 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A persistent atlas of the icons drawn in the list. All icons of one size and
+ * scale factor are kept pre-rasterised in a single ARGB32 image, which is
+ * mmap(2)ed and drawn from directly; icons missing from it are decoded once
+ * and added to it on exit. Icon files that could not be decoded are kept in
+ * it too, without a cell, so that they are not tried again until they change.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include "atlas.h"
+#include "cache.h"
+#include "compat.h"
+
+#define ATLAS_MAGIC	0x42534941	/* "BSIA" */
+#define ATLAS_VERSION	2
+#define ATLAS_COLUMNS	32
+#define ATLAS_MAX	4096		/* Cells kept across runs */
+#define ATLAS_SCALES	4
+
+/*
+ * The file is this header, the records, the NUL-terminated file names that
+ * the records point to, and then the pixels at a 64 byte boundary. The
+ * records of the cells come first, in cell order, and then those of the icons
+ * that could not be decoded.
+ */
+struct atlas_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	cell;		/* Width and height of a cell */
+	uint32_t	count;		/* Number of cells */
+	uint32_t	stride;		/* Bytes per row of pixels */
+	uint32_t	len_names;	/* Length of the file names */
+	uint32_t	pixels;		/* Offset of the pixels */
+	uint32_t	bad;		/* Number of records without a cell */
+};
+
+struct atlas_record {
+	uint32_t	name;		/* Offset into the file names */
+	uint32_t	pad;
+	int64_t		mtime;		/* Of the icon file */
+};
+
+/*
+ * An icon decoded this run, not yet in the atlas file, or with no surface, one
+ * that could not be.
+ */
+struct atlas_fresh {
+	cairo_surface_t	*surface;
+	int64_t		 mtime;
+};
+
+struct atlas {
+	int		 scale;
+	int		 cell;		/* Width and height of a cell */
+	char		*path;
+	char		*map;
+	size_t		 len;
+	cairo_surface_t	*surface;	/* Over the mapped pixels, or NULL */
+	const char	*records;
+	const char	*names;
+	uint32_t	 count;
+	uint32_t	 bad;
+	uint8_t		*used;		/* Which cells were drawn this run */
+	GHashTable	*cells;		/* File name to cell index + 1 */
+	GHashTable	*failed;	/* File name to record index + 1 */
+	GHashTable	*fresh;		/* File name to struct atlas_fresh */
+	int		 dirty;
+};
+
+static struct atlas	*atlases[ATLAS_SCALES];
+
+static struct atlas	*atlas_load(int, int);
+static int		 atlas_cell_fresh(struct atlas *, guint);
+static int		 atlas_record_fresh(struct atlas *, guint, int64_t *);
+static struct atlas_fresh *atlas_decode(struct atlas *, const char *);
+static void		 atlas_fresh_free(gpointer);
+static void		 atlas_blit(struct atlas *, cairo_t *,
+    cairo_surface_t *, int, int, int, int);
+static void		 atlas_save(struct atlas *);
+static void		 atlas_free(struct atlas *);
+
+/*
+ * The atlas for icons of the given size, in pixels at scale 1, and scale
+ * factor.
+ */
+struct atlas *
+atlas_get(int size, int scale)
+{
+	if (scale < 1)
+		scale = 1;
+	if (scale > ATLAS_SCALES)
+		scale = ATLAS_SCALES;
+
+	if (atlases[scale - 1] == NULL)
+		atlases[scale - 1] = atlas_load(size, scale);
+
+	return atlases[scale - 1];
+}
+
+/*
+ * Map the atlas file, if there is a usable one.
+ */
+struct atlas *
+atlas_load(int size, int scale)
+{
+	int			 fd;
+	char			*cdir, *fn, *map;
+	size_t			 len, rows, i;
+	uint32_t		 cell;
+	struct stat		 sb;
+	struct atlas		*a;
+	struct atlas_header	 hdr;
+	struct atlas_record	 rec;
+
+	if ((a = calloc(1, sizeof(struct atlas))) == NULL)
+		err(1, NULL);
+	a->scale = scale;
+	a->cell = cell = size * scale;
+	a->cells = g_hash_table_new(g_str_hash, g_str_equal);
+	a->failed = g_hash_table_new(g_str_hash, g_str_equal);
+	a->fresh = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	    atlas_fresh_free);
+
+	cdir = cache_dir();
+	fn = g_strdup_printf("atlas-%d@%d", size, scale);
+	a->path = g_build_filename(cdir, fn, NULL);
+	g_free(fn);
+	g_free(cdir);
+
+	if ((fd = open(a->path, O_RDONLY)) < 0)
+		return a;
+	if (fstat(fd, &sb) < 0 || !cache_trusted(&sb, a->path) ||
+	    (size_t)sb.st_size < sizeof(hdr))
+		goto done;
+
+	len = sb.st_size;
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto done;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	rows = (hdr.count + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+	if (hdr.magic != ATLAS_MAGIC || hdr.version != ATLAS_VERSION ||
+	    hdr.cell != cell || hdr.count > ATLAS_MAX ||
+	    hdr.bad > ATLAS_MAX || hdr.count + hdr.bad == 0 ||
+	    hdr.stride != (uint32_t)cairo_format_stride_for_width(
+	    CAIRO_FORMAT_ARGB32, ATLAS_COLUMNS * cell) ||
+	    sizeof(hdr) + (hdr.count + hdr.bad) * sizeof(rec) +
+	    hdr.len_names > hdr.pixels || hdr.pixels % 64 != 0 ||
+	    hdr.pixels + rows * cell * hdr.stride > len ||
+	    hdr.len_names == 0 || map[sizeof(hdr) +
+	    (hdr.count + hdr.bad) * sizeof(rec) + hdr.len_names - 1]) {
+		munmap(map, len);
+		goto done;
+	}
+
+	a->map = map;
+	a->len = len;
+	a->count = hdr.count;
+	a->bad = hdr.bad;
+	a->records = map + sizeof(hdr);
+	a->names = a->records + (hdr.count + hdr.bad) * sizeof(rec);
+	if (a->count > 0)
+		a->surface = cairo_image_surface_create_for_data(
+		    (unsigned char *)map + hdr.pixels, CAIRO_FORMAT_ARGB32,
+		    ATLAS_COLUMNS * cell, rows * cell, hdr.stride);
+	if ((a->used = calloc(a->count + 1, sizeof(uint8_t))) == NULL)
+		err(1, NULL);
+
+	for (i = 0; i < a->count + a->bad; i++) {
+		memcpy(&rec, a->records + i * sizeof(rec), sizeof(rec));
+		if (rec.name < hdr.len_names)
+			g_hash_table_insert(i < a->count ? a->cells : a->failed,
+			    (gpointer)(a->names + rec.name),
+			    GUINT_TO_POINTER(i + 1));
+	}
+
+done:
+	close(fd);
+	return a;
+}
+
+/*
+ * Draw the icon in the given file at x, y. Icons are taken from the atlas if
+ * it has them and they have not changed since, and otherwise decoded and
+ * remembered for the next atlas. Returns 0 if the icon could not be drawn.
+ */
+int
+atlas_paint(struct atlas *a, cairo_t *cr, const char *fn, int x, int y)
+{
+	gpointer		 v;
+	guint			 i;
+	int64_t			 mtime;
+	struct atlas_fresh	*f;
+
+	if ((v = g_hash_table_lookup(a->cells, fn)) != NULL) {
+		i = GPOINTER_TO_UINT(v) - 1;
+
+		/* A cell is checked the first time it is drawn in a run. */
+		if (a->used[i] || atlas_cell_fresh(a, i)) {
+			a->used[i] = 1;
+			atlas_blit(a, cr, a->surface, x, y,
+			    (i % ATLAS_COLUMNS) * a->cell,
+			    (i / ATLAS_COLUMNS) * a->cell);
+			return 1;
+		}
+
+		/* Decoded afresh below; the save drops the old cell. */
+		g_hash_table_remove(a->cells, fn);
+	}
+
+	/* A file that failed before is only tried again once it changes. */
+	if ((v = g_hash_table_lookup(a->failed, fn)) != NULL) {
+		g_hash_table_remove(a->failed, fn);
+		if (atlas_record_fresh(a, GPOINTER_TO_UINT(v) - 1, &mtime)) {
+			if ((f = malloc(sizeof(struct atlas_fresh))) == NULL)
+				err(1, NULL);
+			f->surface = NULL;
+			f->mtime = mtime;
+			g_hash_table_insert(a->fresh, g_strdup(fn), f);
+		}
+	}
+
+	if (!g_hash_table_lookup_extended(a->fresh, fn, NULL, &v)) {
+		v = atlas_decode(a, fn);
+		g_hash_table_insert(a->fresh, g_strdup(fn), v);
+		a->dirty = 1;
+	}
+
+	if ((f = v) == NULL || f->surface == NULL)
+		return 0;
+
+	atlas_blit(a, cr, f->surface, x, y, 0, 0);
+	return 1;
+}
+
+/*
+ * Whether the icon file of a cell still has the modification time it had when
+ * the cell was drawn.
+ */
+int
+atlas_cell_fresh(struct atlas *a, guint i)
+{
+	return atlas_record_fresh(a, i, NULL);
+}
+
+/*
+ * Whether the icon file of a record, with a cell or not, still has the same
+ * modification time, which is also stored if mtime is not NULL.
+ */
+int
+atlas_record_fresh(struct atlas *a, guint i, int64_t *mtime)
+{
+	struct stat		sb;
+	struct atlas_record	rec;
+
+	memcpy(&rec, a->records + i * sizeof(rec), sizeof(rec));
+	if (mtime)
+		*mtime = rec.mtime;
+	return stat(a->names + rec.name, &sb) == 0 &&
+	    (int64_t)sb.st_mtime == rec.mtime;
+}
+
+/*
+ * Decode an icon file into an image surface of one cell. Returns NULL if there
+ * is no such file, and one without a surface if it could not be decoded.
+ */
+struct atlas_fresh *
+atlas_decode(struct atlas *a, const char *fn)
+{
+	struct stat		 sb;
+	GdkPixbuf		*pixbuf;
+	struct atlas_fresh	*f;
+
+	if (stat(fn, &sb) < 0)
+		return NULL;
+
+	if ((f = malloc(sizeof(struct atlas_fresh))) == NULL)
+		err(1, NULL);
+	f->surface = NULL;
+	f->mtime = sb.st_mtime;
+
+	if ((pixbuf = gdk_pixbuf_new_from_file_at_size(fn, a->cell, a->cell,
+	    NULL)) != NULL) {
+		f->surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, 1,
+		    NULL);
+		g_object_unref(pixbuf);
+	}
+
+	return f;
+}
+
+void
+atlas_fresh_free(gpointer data)
+{
+	struct atlas_fresh	*f = data;
+
+	if (f) {
+		if (f->surface)
+			cairo_surface_destroy(f->surface);
+		free(f);
+	}
+}
+
+/*
+ * Copy one cell from the source surface to x, y. The source is in device
+ * pixels, which are scale times smaller than the user units of the context.
+ */
+void
+atlas_blit(struct atlas *a, cairo_t *cr, cairo_surface_t *src, int x, int y,
+    int src_x, int src_y)
+{
+	cairo_save(cr);
+	cairo_translate(cr, x, y);
+	cairo_scale(cr, 1.0 / a->scale, 1.0 / a->scale);
+	cairo_rectangle(cr, 0, 0, a->cell, a->cell);
+	cairo_clip(cr);
+	cairo_set_source_surface(cr, src, -src_x, -src_y);
+	cairo_paint(cr);
+	cairo_restore(cr);
+}
+
+/*
+ * Write every atlas that gained icons this run, and free them all.
+ */
+void
+atlas_save_all(void)
+{
+	int	i;
+
+	for (i = 0; i < ATLAS_SCALES; i++) {
+		if (atlases[i] == NULL)
+			continue;
+		if (atlases[i]->dirty)
+			atlas_save(atlases[i]);
+		atlas_free(atlases[i]);
+		atlases[i] = NULL;
+	}
+}
+
+/*
+ * Write a new atlas file: the cells of the old atlas whose icons have not
+ * changed, followed by the icons decoded this run. Only the new icons were
+ * ever decoded; the old cells are copied over as pixels. The files that
+ * could not be decoded, this run or before, follow without cells.
+ */
+void
+atlas_save(struct atlas *a)
+{
+	int			 fd, failed;
+	char			*cdir, *tmp = NULL;
+	guint			 j;
+	size_t			 i, k, n, rows;
+	FILE			*fp;
+	GArray			*keep, *recs, *bad;
+	GString			*names;
+	GPtrArray		*fresh_names, *bad_names;
+	GHashTableIter		 iter;
+	gpointer		 key, v;
+	cairo_t			*cr;
+	cairo_surface_t		*surface;
+	struct stat		 sb;
+	struct atlas_header	 hdr;
+	struct atlas_record	 rec, old;
+	struct atlas_fresh	*f;
+	static const char	 zeros[64];
+
+	keep = g_array_new(FALSE, FALSE, sizeof(guint));
+	bad = g_array_new(FALSE, FALSE, sizeof(guint));
+	recs = g_array_new(FALSE, FALSE, sizeof(struct atlas_record));
+	names = g_string_new(NULL);
+	fresh_names = g_ptr_array_new();
+	bad_names = g_ptr_array_new();
+
+	g_hash_table_iter_init(&iter, a->fresh);
+	while (g_hash_table_iter_next(&iter, &key, &v)) {
+		if ((f = v) == NULL)
+			continue;
+		if (f->surface && fresh_names->len < ATLAS_MAX)
+			g_ptr_array_add(fresh_names, key);
+		else if (f->surface == NULL && bad_names->len < ATLAS_MAX)
+			g_ptr_array_add(bad_names, key);
+	}
+
+	/* Failures not looked at this run are kept while they still hold. */
+	g_hash_table_iter_init(&iter, a->failed);
+	while (g_hash_table_iter_next(&iter, NULL, &v)) {
+		if (bad->len + bad_names->len >= ATLAS_MAX)
+			break;
+		j = GPOINTER_TO_UINT(v) - 1;
+		if (atlas_record_fresh(a, j, NULL))
+			g_array_append_vals(bad, &j, 1);
+	}
+
+	/* Keep cells drawn this run first, then any others that fit. */
+	for (k = 0; k < 2; k++) {
+		for (i = 0; i < a->count; i++) {
+			if (a->used[i] != (k == 0))
+				continue;
+			if (keep->len + fresh_names->len >= ATLAS_MAX)
+				break;
+			memcpy(&old, a->records + i * sizeof(old), sizeof(old));
+			if (stat(a->names + old.name, &sb) < 0 ||
+			    (int64_t)sb.st_mtime != old.mtime)
+				continue;
+			j = i;
+			g_array_append_vals(keep, &j, 1);
+		}
+	}
+
+	n = keep->len + fresh_names->len;
+	rows = (n + ATLAS_COLUMNS - 1) / ATLAS_COLUMNS;
+	if (n + bad->len + bad_names->len == 0) {
+		unlink(a->path);
+		goto done;
+	}
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+	    ATLAS_COLUMNS * a->cell, rows * a->cell);
+	cr = cairo_create(surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+
+	for (k = 0; k < n; k++) {
+		memset(&rec, 0, sizeof(rec));
+		rec.name = names->len;
+
+		cairo_save(cr);
+		cairo_translate(cr, (k % ATLAS_COLUMNS) * a->cell,
+		    (k / ATLAS_COLUMNS) * a->cell);
+		cairo_rectangle(cr, 0, 0, a->cell, a->cell);
+		cairo_clip(cr);
+
+		if (k < keep->len) {
+			i = g_array_index(keep, guint, k);
+			memcpy(&old, a->records + i * sizeof(old), sizeof(old));
+			g_string_append_len(names, a->names + old.name,
+			    strlen(a->names + old.name) + 1);
+			rec.mtime = old.mtime;
+			cairo_set_source_surface(cr, a->surface,
+			    -(double)((i % ATLAS_COLUMNS) * a->cell),
+			    -(double)((i / ATLAS_COLUMNS) * a->cell));
+		} else {
+			key = g_ptr_array_index(fresh_names, k - keep->len);
+			f = g_hash_table_lookup(a->fresh, key);
+			g_string_append_len(names, key, strlen(key) + 1);
+			rec.mtime = f->mtime;
+			cairo_set_source_surface(cr, f->surface, 0, 0);
+		}
+
+		cairo_paint(cr);
+		cairo_restore(cr);
+		g_array_append_vals(recs, &rec, 1);
+	}
+
+	for (k = 0; k < bad->len + bad_names->len; k++) {
+		memset(&rec, 0, sizeof(rec));
+		rec.name = names->len;
+		if (k < bad->len) {
+			i = g_array_index(bad, guint, k);
+			memcpy(&old, a->records + i * sizeof(old), sizeof(old));
+			key = (gpointer)(a->names + old.name);
+			rec.mtime = old.mtime;
+		} else {
+			key = g_ptr_array_index(bad_names, k - bad->len);
+			f = g_hash_table_lookup(a->fresh, key);
+			rec.mtime = f->mtime;
+		}
+		g_string_append_len(names, key, strlen(key) + 1);
+		g_array_append_vals(recs, &rec, 1);
+	}
+
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = ATLAS_MAGIC;
+	hdr.version = ATLAS_VERSION;
+	hdr.cell = a->cell;
+	hdr.count = n;
+	hdr.bad = recs->len - n;
+	hdr.stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32,
+	    ATLAS_COLUMNS * a->cell);
+	hdr.len_names = names->len;
+	hdr.pixels = sizeof(hdr) + recs->len * sizeof(rec) + names->len;
+	hdr.pixels = (hdr.pixels + 63) & ~63u;
+
+	cdir = cache_dir();
+	if (g_mkdir_with_parents(cdir, 0755) < 0) {
+		g_free(cdir);
+		goto free;
+	}
+	g_free(cdir);
+
+	tmp = g_strdup_printf("%s.XXXXXX", a->path);
+	if ((fd = mkstemp(tmp)) < 0) {
+		warn("mkstemp: %s", tmp);
+		goto free;
+	}
+	fchmod(fd, 0644);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		warn("fdopen");
+		close(fd);
+		unlink(tmp);
+		goto free;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(recs->data, sizeof(rec), recs->len, fp);
+	fwrite(names->str, 1, names->len, fp);
+	fwrite(zeros, 1, hdr.pixels - (sizeof(hdr) + recs->len * sizeof(rec) +
+	    names->len), fp);
+	if (rows > 0)
+		fwrite(cairo_image_surface_get_data(surface), hdr.stride,
+		    rows * a->cell, fp);
+
+	failed = ferror(fp);
+	if (fclose(fp) != 0 || failed) {
+		warnx("could not write %s", tmp);
+		unlink(tmp);
+	} else if (rename(tmp, a->path) < 0) {
+		warn("rename: %s", a->path);
+		unlink(tmp);
+	}
+
+free:
+	g_free(tmp);
+	cairo_surface_destroy(surface);
+done:
+	g_ptr_array_free(bad_names, TRUE);
+	g_ptr_array_free(fresh_names, TRUE);
+	g_string_free(names, TRUE);
+	g_array_free(recs, TRUE);
+	g_array_free(bad, TRUE);
+	g_array_free(keep, TRUE);
+}
+
+/*
+ * Unmap and free an atlas.
+ */
+void
+atlas_free(struct atlas *a)
+{
+	if (a->surface)
+		cairo_surface_destroy(a->surface);
+	if (a->map)
+		munmap(a->map, a->len);
+	g_hash_table_unref(a->cells);
+	g_hash_table_unref(a->failed);
+	g_hash_table_unref(a->fresh);
+	free(a->used);
+	g_free(a->path);
+	free(a);
+}
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Benchmarks, for comparing changes. They need a display, but never show a
+ * window; run them under Xvfb or with GDK_BACKEND=broadway.
+ *
+ * The startup benchmark runs the program itself over and over, each time told
+ * through the environment to signal a pipe once the list is first painted and
+ * then to exit.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include "bench.h"
+#include "entrycellrenderer.h"
+#include "compat.h"
+
+#define BENCH_WIDTH	400
+#define BENCH_HEIGHT	300
+
+#define BENCH_FD_ENV	"BYTESTREAM_BENCH_FD"
+#define BENCH_BUDGET_ENV "BYTESTREAM_BENCH_BUDGET_MS"
+
+#define BENCH_TYPED	3	/* Letters typed per search */
+
+enum {
+	BENCH_OPEN,
+	BENCH_SCROLL,
+	BENCH_SEARCH,
+	BENCH_LAUNCH,
+	BENCH_STEPS,
+};
+
+static const char	*bench_steps[BENCH_STEPS] = {
+	"open", "scroll", "search", "launch",
+};
+
+static GtkWidget	*bench_window(GtkWidget *);
+static void		 bench_settle(void);
+static void		 bench_draw(GtkWidget *, cairo_surface_t *);
+static void		 bench_scroll(GtkWidget *, cairo_surface_t *, GArray *);
+static void		 bench_search(GtkTreeView *, GtkEntry *, int);
+static void		 bench_launch(GtkTreeView *);
+static int		 bench_spawn(const char *, const char *, GArray *);
+static int		 bench_drop_caches(void);
+static void		 bench_rmtree(const char *);
+static void		 bench_print_ms(const char *, GArray *);
+static gint		 bench_compare(gconstpointer, gconstpointer);
+static double		 bench_percentile(GArray *, double);
+static gint64		 bench_heap(void);
+
+/*
+ * Scroll the tree view from top to bottom, a quarter page per frame, drawing
+ * each frame offscreen. Report the frame times, the rows rendered per second,
+ * and the heap growth per frame as JSON. Fails if the 90th percentile frame
+ * takes longer than the budget in the environment, if there is one.
+ */
+int
+bench_render(GtkWidget *tree)
+{
+	int		 ret = 0;
+	guint		 i;
+	char		*end;
+	const char	*env;
+	double		 budget, p90;
+	gint64		 total = 0, heap0, heap1;
+	guint64		 rows;
+	GArray		*times;
+	GtkWidget	*offscreen;
+	cairo_surface_t	*surface;
+
+	offscreen = bench_window(tree);
+	bench_settle();
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BENCH_WIDTH,
+	    BENCH_HEIGHT);
+	times = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+	rows = bs_cell_renderer_entry_get_render_count();
+	heap0 = bench_heap();
+
+	bench_scroll(offscreen, surface, times);
+
+	heap1 = bench_heap();
+	rows = bs_cell_renderer_entry_get_render_count() - rows;
+	for (i = 0; i < times->len; i++)
+		total += g_array_index(times, gint64, i);
+	g_array_sort(times, bench_compare);
+
+	printf("{\"frames\": %u, ", times->len);
+	bench_print_ms("frame_ms", times);
+	printf(", \"rows_per_second\": %.0f, ",
+	    total > 0 ? rows * 1e6 / total : 0);
+	if (heap0 >= 0 && heap1 >= 0)
+		printf("\"heap_bytes_per_frame\": %.1f}\n",
+		    (double)(heap1 - heap0) / times->len);
+	else
+		printf("\"heap_bytes_per_frame\": null}\n");
+
+	if ((env = getenv(BENCH_BUDGET_ENV)) != NULL && *env != '\0') {
+		budget = g_ascii_strtod(env, &end);
+		if (*end != '\0' || budget <= 0)
+			errx(1, "%s: not a number of milliseconds",
+			    BENCH_BUDGET_ENV);
+		if ((p90 = bench_percentile(times, 0.90)) > budget) {
+			warnx("90th percentile frame took %.3f ms, over the "
+			    "budget of %.3f ms", p90, budget);
+			ret = 1;
+		}
+	}
+
+	g_array_free(times, TRUE);
+	cairo_surface_destroy(surface);
+	gtk_widget_destroy(offscreen);
+
+	return ret;
+}
+
+/*
+ * Open the list, scroll through it, search it, and launch from it, over and
+ * over, and report how much the heap grew per cycle and per step as JSON. The
+ * first cycle fills the caches that live as long as the program, so it is not
+ * counted.
+ */
+int
+bench_stress(int cycles, bench_open_func open, gpointer data)
+{
+	int		 c, step;
+	gint64		 mark, now, growth[BENCH_STEPS] = { 0 }, total = 0;
+	GtkWidget	*tree, *offscreen, *entry;
+	cairo_surface_t	*surface;
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BENCH_WIDTH,
+	    BENCH_HEIGHT);
+	entry = g_object_ref_sink(gtk_entry_new());
+
+	if (bench_heap() < 0)
+		warnx("the heap cannot be measured here; only stressing");
+
+	for (c = 0; c <= cycles; c++) {
+		if (c == 1)
+			for (step = 0; step < BENCH_STEPS; step++)
+				growth[step] = 0;
+
+		mark = bench_heap();
+		tree = open(data);
+		offscreen = bench_window(tree);
+		bench_settle();
+		now = bench_heap();
+		growth[BENCH_OPEN] += now - mark;
+
+		mark = now;
+		bench_scroll(offscreen, surface, NULL);
+		now = bench_heap();
+		growth[BENCH_SCROLL] += now - mark;
+
+		mark = now;
+		gtk_tree_view_set_search_entry(GTK_TREE_VIEW(tree),
+		    GTK_ENTRY(entry));
+		bench_search(GTK_TREE_VIEW(tree), GTK_ENTRY(entry), c);
+		now = bench_heap();
+		growth[BENCH_SEARCH] += now - mark;
+
+		mark = now;
+		bench_launch(GTK_TREE_VIEW(tree));
+		now = bench_heap();
+		growth[BENCH_LAUNCH] += now - mark;
+
+		/* Closing should give back what opening took. */
+		mark = now;
+		gtk_widget_destroy(offscreen);
+		bench_settle();
+		growth[BENCH_OPEN] += bench_heap() - mark;
+	}
+
+	printf("{\"cycles\": %d, \"heap_bytes_per_step\": {", cycles);
+	for (step = 0; step < BENCH_STEPS; step++) {
+		printf("%s\"%s\": ", step ? ", " : "", bench_steps[step]);
+		if (bench_heap() < 0)
+			printf("null");
+		else
+			printf("%.1f", (double)growth[step] / cycles);
+		total += growth[step];
+	}
+	if (bench_heap() < 0)
+		printf("}, \"heap_bytes_per_cycle\": null}\n");
+	else
+		printf("}, \"heap_bytes_per_cycle\": %.1f}\n",
+		    (double)total / cycles);
+
+	g_object_unref(entry);
+	cairo_surface_destroy(surface);
+
+	return 0;
+}
+
+/*
+ * Start the program as itself, from the top, the given number of times with
+ * an empty cache directory and as many times with a cache left by an earlier
+ * run. Report the time from starting it to the first paint of the list, as
+ * JSON.
+ */
+int
+bench_startup(const char *self, int runs)
+{
+	int	 i, dropped = 1, failed = 0;
+	char	*cold, *warm;
+	GArray	*cold_times, *warm_times;
+
+	cold_times = g_array_new(FALSE, FALSE, sizeof(gint64));
+	warm_times = g_array_new(FALSE, FALSE, sizeof(gint64));
+
+	if ((warm = g_dir_make_tmp("bytestream-bench-XXXXXX", NULL)) == NULL)
+		err(1, "g_dir_make_tmp");
+
+	/* Fill the warm cache, and the page cache, once. */
+	if (!bench_spawn(self, warm, NULL))
+		failed++;
+
+	/* Interleave the two so that both see the same machine. */
+	for (i = 0; i < runs; i++) {
+		cold = g_dir_make_tmp("bytestream-bench-XXXXXX", NULL);
+		if (cold == NULL)
+			err(1, "g_dir_make_tmp");
+		dropped &= bench_drop_caches();
+		if (!bench_spawn(self, cold, cold_times))
+			failed++;
+		bench_rmtree(cold);
+		g_free(cold);
+
+		if (!bench_spawn(self, warm, warm_times))
+			failed++;
+	}
+
+	bench_rmtree(warm);
+	g_free(warm);
+
+	g_array_sort(cold_times, bench_compare);
+	g_array_sort(warm_times, bench_compare);
+
+	printf("{\"runs\": %d, \"failed\": %d, ", runs, failed);
+	printf("\"page_cache_dropped\": %s, ", dropped ? "true" : "false");
+	bench_print_ms("cold_ms", cold_times);
+	printf(", ");
+	bench_print_ms("warm_ms", warm_times);
+	printf("}\n");
+
+	g_array_free(cold_times, TRUE);
+	g_array_free(warm_times, TRUE);
+
+	return failed > 0;
+}
+
+/*
+ * The pipe to signal once the list is painted, if this is a run of the
+ * startup benchmark, or -1.
+ */
+int
+bench_paint_fd(void)
+{
+	long	 fd;
+	char	*env, *end;
+
+	if ((env = getenv(BENCH_FD_ENV)) == NULL || *env == '\0')
+		return -1;
+
+	fd = strtol(env, &end, 10);
+	if (*end != '\0' || fd < 0 || fd > INT32_MAX)
+		errx(1, "%s: not a file descriptor", BENCH_FD_ENV);
+
+	/* Anything launched from here is not part of the benchmark. */
+	unsetenv(BENCH_FD_ENV);
+
+	return fd;
+}
+
+/*
+ * Paint the tree view once, offscreen, and then signal the pipe.
+ */
+void
+bench_paint(GtkWidget *tree, int fd)
+{
+	GtkWidget	*offscreen;
+	cairo_surface_t	*surface;
+
+	offscreen = bench_window(tree);
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, BENCH_WIDTH,
+	    BENCH_HEIGHT);
+
+	bench_settle();
+	bench_draw(offscreen, surface);
+
+	if (write(fd, "", 1) != 1)
+		warn("write");
+	close(fd);
+
+	cairo_surface_destroy(surface);
+	gtk_widget_destroy(offscreen);
+}
+
+/*
+ * Put the tree view in a scrolled window in an offscreen window of the usual
+ * size, and show it.
+ */
+GtkWidget *
+bench_window(GtkWidget *tree)
+{
+	GtkWidget	*offscreen, *scrollable;
+
+	offscreen = gtk_offscreen_window_new();
+	scrollable = gtk_scrolled_window_new(NULL, NULL);
+	gtk_widget_set_size_request(offscreen, BENCH_WIDTH, BENCH_HEIGHT);
+	gtk_container_add(GTK_CONTAINER(scrollable), tree);
+	gtk_container_add(GTK_CONTAINER(offscreen), scrollable);
+	gtk_widget_show_all(offscreen);
+
+	return offscreen;
+}
+
+/*
+ * Run the main loop until GTK has finished laying out.
+ */
+void
+bench_settle(void)
+{
+	while (gtk_events_pending())
+		gtk_main_iteration();
+}
+
+/*
+ * Draw the window onto the surface, and wait for the drawing to finish.
+ */
+void
+bench_draw(GtkWidget *offscreen, cairo_surface_t *surface)
+{
+	cairo_t	*cr;
+
+	cr = cairo_create(surface);
+	gtk_widget_draw(offscreen, cr);
+	cairo_destroy(cr);
+	cairo_surface_flush(surface);
+}
+
+/*
+ * Scroll the window from top to bottom, a quarter page per frame, drawing each
+ * frame onto the surface. Add the frame times to the array, if given.
+ */
+void
+bench_scroll(GtkWidget *offscreen, cairo_surface_t *surface, GArray *times)
+{
+	int		 done = 0;
+	gint64		 t0, dt;
+	double		 value = 0, page, upper;
+	GtkAdjustment	*adj;
+
+	adj = gtk_scrolled_window_get_vadjustment(
+	    GTK_SCROLLED_WINDOW(gtk_bin_get_child(GTK_BIN(offscreen))));
+
+	while (!done) {
+		t0 = g_get_monotonic_time();
+
+		page = gtk_adjustment_get_page_size(adj);
+		upper = gtk_adjustment_get_upper(adj) - page;
+		if (value >= upper) {
+			value = upper;
+			done = 1;
+		}
+		gtk_adjustment_set_value(adj, value);
+		bench_settle();
+
+		bench_draw(offscreen, surface);
+
+		dt = g_get_monotonic_time() - t0;
+		if (times)
+			g_array_append_val(times, dt);
+
+		value += page > 4 ? page / 4 : 1;
+	}
+}
+
+/*
+ * Type the start of the name of one of the rows into the search entry, a
+ * letter at a time, and then clear it.
+ */
+void
+bench_search(GtkTreeView *tree_view, GtkEntry *entry, int n)
+{
+	int		 typed;
+	char		*name = NULL, *key;
+	const char	*end;
+	GtkTreeIter	 iter;
+	GtkTreeModel	*model;
+
+	model = gtk_tree_view_get_model(tree_view);
+	n %= MAX(gtk_tree_model_iter_n_children(model, NULL), 1);
+	if (gtk_tree_model_iter_nth_child(model, &iter, NULL, n))
+		gtk_tree_model_get(model, &iter,
+		    gtk_tree_view_get_search_column(tree_view), &name, -1);
+	if (name == NULL)
+		return;
+
+	for (end = name, typed = 0; *end && typed < BENCH_TYPED; typed++) {
+		end = g_utf8_next_char(end);
+		key = g_strndup(name, end - name);
+		gtk_entry_set_text(entry, key);
+		bench_settle();
+		g_free(key);
+	}
+	gtk_entry_set_text(entry, "");
+	bench_settle();
+
+	g_free(name);
+}
+
+/*
+ * Activate the row under the cursor, or the first row.
+ */
+void
+bench_launch(GtkTreeView *tree_view)
+{
+	GtkTreePath		*path;
+	GtkTreeViewColumn	*column;
+
+	gtk_tree_view_get_cursor(tree_view, &path, &column);
+	if (path == NULL)
+		path = gtk_tree_path_new_first();
+
+	gtk_tree_view_row_activated(tree_view, path, column);
+	gtk_tree_path_free(path);
+	bench_settle();
+}
+
+/*
+ * Run the program with the given cache directory, and add the time until it
+ * first painted the list to the times. Return whether it succeeded.
+ */
+int
+bench_spawn(const char *self, const char *cdir, GArray *times)
+{
+	int	 fds[2], status;
+	char	 fd[16];
+	ssize_t	 n;
+	pid_t	 pid;
+	gint64	 t0, dt;
+
+	if (pipe(fds) == -1)
+		err(1, "pipe");
+
+	t0 = g_get_monotonic_time();
+
+	switch ((pid = fork())) {
+	case -1:
+		err(1, "fork");
+	case 0:
+		close(fds[0]);
+		snprintf(fd, sizeof(fd), "%d", fds[1]);
+		if (setenv(BENCH_FD_ENV, fd, 1) == -1 ||
+		    setenv("BYTESTREAM_CACHE_DIR", cdir, 1) == -1)
+			err(1, "setenv");
+		execlp(self, self, (char *)NULL);
+		err(1, "%s", self);
+	}
+
+	close(fds[1]);
+	while ((n = read(fds[0], fd, 1)) == -1 && errno == EINTR)
+		;
+	dt = g_get_monotonic_time() - t0;
+	close(fds[0]);
+
+	/* It finishes writing its caches before it exits. */
+	while (waitpid(pid, &status, 0) == -1)
+		if (errno != EINTR)
+			err(1, "waitpid");
+
+	if (n != 1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		warnx("%s: startup run failed", self);
+		return 0;
+	}
+
+	if (times)
+		g_array_append_val(times, dt);
+	return 1;
+}
+
+/*
+ * Drop the clean pages from the page cache, so that a cold run reads from the
+ * disk. Only root can do this, and only on Linux; return whether it worked.
+ */
+int
+bench_drop_caches(void)
+{
+	int	fd, ok;
+
+	sync();
+
+	if ((fd = open("/proc/sys/vm/drop_caches", O_WRONLY)) == -1)
+		return 0;
+
+	ok = write(fd, "3\n", 2) == 2;
+	close(fd);
+
+	return ok;
+}
+
+/*
+ * Remove a directory and everything in it.
+ */
+void
+bench_rmtree(const char *path)
+{
+	char		*fn;
+	const char	*name;
+	GDir		*dir;
+
+	if ((dir = g_dir_open(path, 0, NULL)) != NULL) {
+		while ((name = g_dir_read_name(dir)) != NULL) {
+			fn = g_build_filename(path, name, NULL);
+			if (g_file_test(fn, G_FILE_TEST_IS_DIR) &&
+			    !g_file_test(fn, G_FILE_TEST_IS_SYMLINK))
+				bench_rmtree(fn);
+			else if (unlink(fn) == -1)
+				warn("%s", fn);
+			g_free(fn);
+		}
+		g_dir_close(dir);
+	}
+
+	if (rmdir(path) == -1)
+		warn("%s", path);
+}
+
+/*
+ * Print the percentiles of the sorted times as a named JSON object.
+ */
+void
+bench_print_ms(const char *name, GArray *times)
+{
+	printf("\"%s\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, "
+	    "\"max\": %.3f}", name,
+	    bench_percentile(times, 0.50), bench_percentile(times, 0.90),
+	    bench_percentile(times, 0.99), bench_percentile(times, 1));
+}
+
+gint
+bench_compare(gconstpointer a, gconstpointer b)
+{
+	gint64	x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * The q-th quantile of the sorted times, in milliseconds.
+ */
+double
+bench_percentile(GArray *times, double q)
+{
+	if (times->len == 0)
+		return 0;
+
+	return g_array_index(times, gint64, (guint)(q * (times->len - 1))) /
+	    1000.0;
+}
+
+/*
+ * Bytes allocated from the heap, or -1 if the C library cannot tell us.
+ */
+gint64
+bench_heap(void)
+{
+#ifdef HAVE_MALLINFO2
+	struct mallinfo2	mi;
+
+	mi = mallinfo2();
+	return mi.uordblks;
+#else
+	return -1;
+#endif
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <gtk/gtk.h>
+
+typedef GtkWidget	*(*bench_open_func)(gpointer);
+
+int	bench_render(GtkWidget *);
+int	bench_stress(int, bench_open_func, gpointer);
+int	bench_startup(const char *, int);
+int	bench_paint_fd(void);
+void	bench_paint(GtkWidget *, int);
+
+#endif /* _BENCH_H */
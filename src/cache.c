@@ -0,0 +1,631 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <locale.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "compat.h"
+
+#define CACHE_MAGIC	0x42534543	/* "BSEC" */
+#define CACHE_VERSION	11
+
+#define CACHE_TERM	(1 << 0)
+#define CACHE_HIDDEN	(1 << 1)
+#define CACHE_ACTIONS	(1 << 2)
+#define CACHE_DBUS	(1 << 3)
+#define CACHE_NOTIFY	(1 << 4)
+#define CACHE_SHADOWED	(1 << 5)
+
+/*
+ * The entries found in one applications directory are cached together, once
+ * per locale. The file starts with this header, followed by the key, followed
+ * by the records. Each record is a byte of field codes, a byte of CACHE_*
+ * flags, the OnlyShowIn and NotShowIn desktop bits, the modification time and
+ * size of the desktop file as it was parsed, and then the NUL-terminated
+ * name, exec, icon, collation key, generic name, keywords, comment, TryExec,
+ * unknown OnlyShowIn and NotShowIn names, the path of the desktop file,
+ * StartupWMClass, and MimeType. Files that were shadowed by an
+ * earlier directory are recorded by path alone, so that the cache can tell
+ * when they stop being shadowed.
+ */
+struct cache_header {
+	uint32_t	magic;
+	uint32_t	version;
+	int64_t		mtime;		/* Of the applications directory */
+	uint32_t	count;		/* Number of records */
+	uint32_t	len_key;	/* Length of the key, including NUL */
+};
+
+struct cache {
+	char		*map;		/* The mmap(2)ed cache file */
+	size_t		 len;		/* Length of the map */
+	const char	*records;	/* The first record */
+	const char	*p;		/* The next record */
+	uint32_t	 count;		/* Number of records */
+	uint32_t	 left;		/* Records not yet read */
+};
+
+struct cache_writer {
+	FILE		*fp;
+	char		*key;
+	char		*path;
+	char		*tmp;
+	int64_t		 mtime;
+	uint32_t	 count;
+};
+
+static struct cache	*cache_map(const char *, const struct stat *);
+static int		 cache_read(struct cache *, struct entry *, int64_t *,
+    int64_t *);
+static int		 cache_files_hold(struct cache *);
+static char		*cache_key(const char *);
+static char		*cache_path(const char *);
+static const char	*cache_string(struct cache *);
+static void		 cache_write_header(struct cache_writer *);
+
+/*
+ * The directory holding all cache files, which BYTESTREAM_CACHE_DIR overrides.
+ */
+char *
+cache_dir(void)
+{
+	const char	*dir;
+
+	if ((dir = getenv("BYTESTREAM_CACHE_DIR")) != NULL && *dir)
+		return g_strdup(dir);
+
+	return g_build_filename(g_get_user_cache_dir(), "bytestream", NULL);
+}
+
+/*
+ * The key identifies the applications directory, the locale fallback chain,
+ * and the collation locale, which together determine the cached strings.
+ */
+char *
+cache_key(const char *dir)
+{
+	char		*chain, *key;
+	const char	*collate;
+
+	if ((collate = setlocale(LC_COLLATE, NULL)) == NULL)
+		collate = "C";
+
+	chain = g_strjoinv(":", (gchar **)g_get_language_names());
+	key = g_strdup_printf("%s\n%s\n%s", dir, chain, collate);
+	g_free(chain);
+
+	return key;
+}
+
+/*
+ * The file name of the cache for the given key: an FNV-1a hash of the key.
+ */
+char *
+cache_path(const char *key)
+{
+	char		*cdir, *fn, *path;
+	uint32_t	 h = 2166136261u;
+
+	for (; *key; key++) {
+		h ^= (unsigned char)*key;
+		h *= 16777619u;
+	}
+
+	cdir = cache_dir();
+	fn = g_strdup_printf("entries-%08x", h);
+	path = g_build_filename(cdir, fn, NULL);
+	g_free(fn);
+	g_free(cdir);
+
+	return path;
+}
+
+/*
+ * The cache file for an applications directory in the current locale.
+ */
+char *
+cache_file(const char *dir)
+{
+	char	*key, *path;
+
+	key = cache_key(dir);
+	path = cache_path(key);
+	g_free(key);
+
+	return path;
+}
+
+/*
+ * Whether the cache file was written for the applications directory as it is
+ * now. This only reads the header, and checks neither the key nor the desktop
+ * files; it is meant for guessing which files will be needed.
+ */
+int
+cache_is_fresh(const char *path, const char *dir)
+{
+	int			 fd;
+	ssize_t			 n;
+	struct stat		 dsb;
+	struct cache_header	 hdr;
+
+	if (stat(dir, &dsb) < 0 || (fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+	n = read(fd, &hdr, sizeof(hdr));
+	close(fd);
+
+	return n == sizeof(hdr) && hdr.magic == CACHE_MAGIC &&
+	    hdr.version == CACHE_VERSION && hdr.mtime == (int64_t)dsb.st_mtime;
+}
+
+/*
+ * Open the cache for an applications directory. Returns NULL if there is no
+ * cache for this directory and locale, or if the directory or any of its
+ * desktop files has changed since it was written.
+ */
+struct cache *
+cache_open(const char *dir)
+{
+	struct stat	dsb;
+
+	if (stat(dir, &dsb) < 0)
+		return NULL;
+
+	return cache_map(dir, &dsb);
+}
+
+/*
+ * Open the cache for an applications directory however old it is, without
+ * looking at the directory, which may not answer.
+ */
+struct cache *
+cache_open_stale(const char *dir)
+{
+	return cache_map(dir, NULL);
+}
+
+/*
+ * Map the cache for the directory, if it was written for the modification
+ * time in dsb and its desktop files are unchanged, or for any if dsb is NULL.
+ */
+struct cache *
+cache_map(const char *dir, const struct stat *dsb)
+{
+	int			 fd;
+	char			*key, *path, *map;
+	size_t			 len;
+	struct stat		 sb;
+	struct cache_header	 hdr;
+	struct cache		*c = NULL;
+
+	key = cache_key(dir);
+	path = cache_path(key);
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		goto done;
+	if (fstat(fd, &sb) < 0 || !cache_trusted(&sb, path) ||
+	    (size_t)sb.st_size <= sizeof(hdr))
+		goto close;
+
+	len = sb.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto close;
+
+	memcpy(&hdr, map, sizeof(hdr));
+	if (hdr.magic != CACHE_MAGIC || hdr.version != CACHE_VERSION ||
+	    (dsb && hdr.mtime != (int64_t)dsb->st_mtime) ||
+	    hdr.len_key != strlen(key) + 1 ||
+	    sizeof(hdr) + hdr.len_key > len ||
+	    memcmp(map + sizeof(hdr), key, hdr.len_key) != 0 ||
+	    map[len - 1] != '\0') {
+		munmap(map, len);
+		goto close;
+	}
+
+	if ((c = malloc(sizeof(struct cache))) == NULL)
+		err(1, NULL);
+	c->map = map;
+	c->len = len;
+	c->records = c->p = map + sizeof(hdr) + hdr.len_key;
+	c->count = c->left = hdr.count;
+
+	if (dsb && !cache_files_hold(c)) {
+		cache_close(c);
+		c = NULL;
+	}
+
+close:
+	close(fd);
+done:
+	g_free(path);
+	g_free(key);
+	return c;
+}
+
+/*
+ * Whether a cache file may be used. Its Exec lines are run as whoever reads
+ * it, so it must belong to this user or to root, and no one else may write
+ * to it.
+ */
+int
+cache_trusted(const struct stat *sb, const char *path)
+{
+	if (sb->st_uid != getuid() && sb->st_uid != 0) {
+		warnx("%s: not owned by this user; ignoring it", path);
+		return 0;
+	}
+	if (sb->st_mode & (S_IWGRP | S_IWOTH)) {
+		warnx("%s: writable by others; ignoring it", path);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Whether every desktop file that was parsed into the cache has the same
+ * modification time and size as then. Editing a file in place does not change
+ * the directory's modification time.
+ */
+int
+cache_files_hold(struct cache *c)
+{
+	int		ret = 1;
+	int64_t		mtime, size;
+	struct stat	sb;
+	struct entry	e;
+
+	while (cache_read(c, &e, &mtime, &size)) {
+		if (e.shadowed || e.file == NULL)
+			continue;
+		if (stat(e.file, &sb) < 0) {
+			sb.st_mtime = -1;
+			sb.st_size = -1;
+		}
+		if ((int64_t)sb.st_mtime != mtime ||
+		    (int64_t)sb.st_size != size) {
+			ret = 0;
+			break;
+		}
+	}
+
+	cache_rewind(c);
+	return ret;
+}
+
+/*
+ * Read the next record into the entry. The strings point into the cache and
+ * are valid until it is closed. Returns 0 when there are no more records.
+ */
+int
+cache_next(struct cache *c, struct entry *e)
+{
+	int64_t	mtime, size;
+
+	return cache_read(c, e, &mtime, &size);
+}
+
+/*
+ * Read the next record into the entry, and the modification time and size of
+ * its desktop file.
+ */
+int
+cache_read(struct cache *c, struct entry *e, int64_t *mtime, int64_t *size)
+{
+	uint8_t	flags;
+
+	if (c->left == 0 || c->map + c->len - c->p < 2 +
+	    2 * (ptrdiff_t)sizeof(uint32_t) + 2 * (ptrdiff_t)sizeof(int64_t))
+		return 0;
+
+	e->fcodes = c->p[0];
+	flags = c->p[1];
+	c->p += 2;
+	memcpy(&e->only_in, c->p, sizeof(uint32_t));
+	c->p += sizeof(uint32_t);
+	memcpy(&e->not_in, c->p, sizeof(uint32_t));
+	c->p += sizeof(uint32_t);
+	memcpy(mtime, c->p, sizeof(int64_t));
+	c->p += sizeof(int64_t);
+	memcpy(size, c->p, sizeof(int64_t));
+	c->p += sizeof(int64_t);
+
+	e->use_term = (flags & CACHE_TERM) != 0;
+	e->hidden = (flags & CACHE_HIDDEN) != 0;
+	e->has_actions = (flags & CACHE_ACTIONS) != 0;
+	e->dbus = (flags & CACHE_DBUS) != 0;
+	e->startup_notify = (flags & CACHE_NOTIFY) != 0;
+	e->shadowed = (flags & CACHE_SHADOWED) != 0;
+
+	if ((e->name = cache_string(c)) == NULL ||
+	    (e->exec = cache_string(c)) == NULL ||
+	    (e->icon = cache_string(c)) == NULL ||
+	    (e->collate = cache_string(c)) == NULL ||
+	    (e->generic = cache_string(c)) == NULL ||
+	    (e->keywords = cache_string(c)) == NULL ||
+	    (e->comment = cache_string(c)) == NULL ||
+	    (e->tryexec = cache_string(c)) == NULL ||
+	    (e->only_in_other = cache_string(c)) == NULL ||
+	    (e->not_in_other = cache_string(c)) == NULL ||
+	    (e->file = cache_string(c)) == NULL ||
+	    (e->wmclass = cache_string(c)) == NULL ||
+	    (e->mimetypes = cache_string(c)) == NULL)
+		return 0;
+
+	if (!*e->exec)
+		e->exec = NULL;
+	if (!*e->icon)
+		e->icon = NULL;
+	if (!*e->generic)
+		e->generic = NULL;
+	if (!*e->keywords)
+		e->keywords = NULL;
+	if (!*e->comment)
+		e->comment = NULL;
+	if (!*e->tryexec)
+		e->tryexec = NULL;
+	if (!*e->only_in_other)
+		e->only_in_other = NULL;
+	if (!*e->not_in_other)
+		e->not_in_other = NULL;
+	if (!*e->file)
+		e->file = NULL;
+	if (!*e->wmclass)
+		e->wmclass = NULL;
+	if (!*e->mimetypes)
+		e->mimetypes = NULL;
+
+	c->left--;
+	return 1;
+}
+
+/*
+ * Go back to the first record.
+ */
+void
+cache_rewind(struct cache *c)
+{
+	c->p = c->records;
+	c->left = c->count;
+}
+
+/*
+ * The NUL-terminated string at the read position.
+ */
+const char *
+cache_string(struct cache *c)
+{
+	const char	*s, *nul;
+
+	nul = memchr(c->p, '\0', c->map + c->len - c->p);
+	if (nul == NULL)
+		return NULL;
+
+	s = c->p;
+	c->p = nul + 1;
+	return s;
+}
+
+/*
+ * Close the cache.
+ */
+void
+cache_close(struct cache *c)
+{
+	if (c) {
+		munmap(c->map, c->len);
+		free(c);
+	}
+}
+
+/*
+ * Start writing the cache for an applications directory. Returns NULL if the
+ * cache cannot be written; callers can pass that NULL along regardless.
+ */
+struct cache_writer *
+cache_writer_new(const char *dir)
+{
+	int			 fd;
+	char			*cdir;
+	struct stat		 sb;
+	struct cache_writer	*w;
+
+	if (stat(dir, &sb) < 0)
+		return NULL;
+
+	/* The directory could change again within this same second. */
+	if (sb.st_mtime >= time(NULL))
+		return NULL;
+
+	cdir = cache_dir();
+	if (g_mkdir_with_parents(cdir, 0755) < 0) {
+		g_free(cdir);
+		return NULL;
+	}
+	g_free(cdir);
+
+	if ((w = calloc(1, sizeof(struct cache_writer))) == NULL)
+		err(1, NULL);
+	w->mtime = sb.st_mtime;
+	w->key = cache_key(dir);
+	w->path = cache_path(w->key);
+	w->tmp = g_strdup_printf("%s.XXXXXX", w->path);
+
+	if ((fd = mkstemp(w->tmp)) < 0) {
+		warn("mkstemp: %s", w->tmp);
+		goto err;
+	}
+	fchmod(fd, 0644);
+	if ((w->fp = fdopen(fd, "w")) == NULL) {
+		warn("fdopen");
+		close(fd);
+		unlink(w->tmp);
+		goto err;
+	}
+
+	cache_write_header(w);
+	fwrite(w->key, 1, strlen(w->key) + 1, w->fp);
+
+	return w;
+
+err:
+	g_free(w->tmp);
+	g_free(w->path);
+	g_free(w->key);
+	free(w);
+	return NULL;
+}
+
+/*
+ * Write the header at the start of the cache file.
+ */
+void
+cache_write_header(struct cache_writer *w)
+{
+	struct cache_header	hdr;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CACHE_MAGIC;
+	hdr.version = CACHE_VERSION;
+	hdr.mtime = w->mtime;
+	hdr.count = w->count;
+	hdr.len_key = strlen(w->key) + 1;
+
+	fwrite(&hdr, sizeof(hdr), 1, w->fp);
+}
+
+/*
+ * Add an entry to the cache. The desktop file was found as in sb before it was
+ * parsed; sb is NULL if it could not be, or was not parsed at all.
+ */
+void
+cache_writer_add(struct cache_writer *w, const struct entry *e,
+    const struct stat *sb)
+{
+	uint8_t	flags = 0;
+	int64_t	mtime = -1, size = -1;
+
+	if (w == NULL)
+		return;
+
+	if (sb) {
+		mtime = sb->st_mtime;
+		size = sb->st_size;
+
+		/* The file could change again within this same second. */
+		if (sb->st_mtime >= time(NULL))
+			mtime = -2;
+	}
+
+	if (e->use_term)
+		flags |= CACHE_TERM;
+	if (e->hidden)
+		flags |= CACHE_HIDDEN;
+	if (e->has_actions)
+		flags |= CACHE_ACTIONS;
+	if (e->dbus)
+		flags |= CACHE_DBUS;
+	if (e->startup_notify)
+		flags |= CACHE_NOTIFY;
+	if (e->shadowed)
+		flags |= CACHE_SHADOWED;
+
+	putc(e->fcodes, w->fp);
+	putc(flags, w->fp);
+	fwrite(&e->only_in, sizeof(uint32_t), 1, w->fp);
+	fwrite(&e->not_in, sizeof(uint32_t), 1, w->fp);
+	fwrite(&mtime, sizeof(int64_t), 1, w->fp);
+	fwrite(&size, sizeof(int64_t), 1, w->fp);
+	fputs(e->name, w->fp);
+	putc('\0', w->fp);
+	fputs(e->exec ? e->exec : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->icon ? e->icon : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->collate ? e->collate : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->generic ? e->generic : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->keywords ? e->keywords : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->comment ? e->comment : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->tryexec ? e->tryexec : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->only_in_other ? e->only_in_other : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->not_in_other ? e->not_in_other : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->file ? e->file : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->wmclass ? e->wmclass : "", w->fp);
+	putc('\0', w->fp);
+	fputs(e->mimetypes ? e->mimetypes : "", w->fp);
+	putc('\0', w->fp);
+
+	w->count++;
+}
+
+/*
+ * Finish the cache file and move it into place.
+ */
+void
+cache_writer_commit(struct cache_writer *w)
+{
+	int	failed;
+
+	if (w == NULL)
+		return;
+
+	if (fseek(w->fp, 0, SEEK_SET) == 0)
+		cache_write_header(w);
+
+	failed = ferror(w->fp);
+	if (fclose(w->fp) != 0 || failed) {
+		warnx("could not write %s", w->tmp);
+		unlink(w->tmp);
+	} else if (rename(w->tmp, w->path) < 0) {
+		warn("rename: %s", w->path);
+		unlink(w->tmp);
+	}
+
+	g_free(w->tmp);
+	g_free(w->path);
+	g_free(w->key);
+	free(w);
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <sys/stat.h>
+
+#include "entry.h"
+
+struct cache;
+struct cache_writer;
+
+char			*cache_dir(void);
+char			*cache_file(const char *);
+int			 cache_trusted(const struct stat *, const char *);
+int			 cache_is_fresh(const char *, const char *);
+struct cache		*cache_open(const char *);
+struct cache		*cache_open_stale(const char *);
+int			 cache_next(struct cache *, struct entry *);
+void			 cache_rewind(struct cache *);
+void			 cache_close(struct cache *);
+struct cache_writer	*cache_writer_new(const char *);
+void			 cache_writer_add(struct cache_writer *,
+    const struct entry *, const struct stat *);
+void			 cache_writer_commit(struct cache_writer *);
+
+#endif /* _CACHE_H */
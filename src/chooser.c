@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Choose a line from the standard input, in the manner of dmenu(1). The
+ * window is shown straight away and the input is read in large blocks at low
+ * priority, so drawing and typing are never held up by it; each block is
+ * appended to a BsLineModel as one batch, filtered as it arrives.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include "chooser.h"
+#include "entrycellrenderer.h"
+#include "linemodel.h"
+#include "compat.h"
+
+#define CHOOSER_BLOCK	(1 << 16)	/* Bytes read at a time */
+
+struct chooser {
+	BsLineModel	*model;
+	GtkWidget	*view;
+	GtkWidget	*entry;
+	GString		*partial;	/* The start of a line not yet ended */
+	char		*chosen;	/* The line to print, once chosen */
+};
+
+static gboolean	 chooser_read(GIOChannel *, GIOCondition, gpointer);
+static void	 chooser_append(struct chooser *, const char *, gsize);
+static void	 chooser_filter(GtkEditable *, gpointer);
+static void	 chooser_choose(struct chooser *, GtkTreePath *);
+static void	 chooser_activated(GtkTreeView *, GtkTreePath *,
+    GtkTreeViewColumn *, gpointer);
+static void	 chooser_response(GtkDialog *, gint, gpointer);
+static void	 chooser_entry_activated(GtkEntry *, gpointer);
+static gboolean	 chooser_key_pressed(GtkWidget *, GdkEvent *, gpointer);
+static void	 chooser_cursor_first(struct chooser *);
+
+/*
+ * Show the lines read from the standard input, and print the one chosen.
+ * Returns the exit status: 0 if something was chosen, and 1 otherwise.
+ */
+int
+chooser_run(void)
+{
+	int			 flags;
+	GtkWidget		*window, *box, *scrollable;
+	GtkCellRenderer		*cellr;
+	GtkTreeViewColumn	*col;
+	GIOChannel		*channel;
+	struct chooser		 ch;
+
+	ch.model = bs_line_model_new();
+	ch.partial = g_string_new(NULL);
+	ch.chosen = NULL;
+
+	if ((flags = fcntl(STDIN_FILENO, F_GETFL)) < 0 ||
+	    fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK) < 0)
+		err(1, "fcntl");
+
+	window = gtk_dialog_new_with_buttons(
+	    "bytestream",
+	    NULL,
+	    0,
+	    "_Close", GTK_RESPONSE_CLOSE,
+	    "_Select", GTK_RESPONSE_OK,
+	    NULL);
+	box = gtk_dialog_get_content_area(GTK_DIALOG(window));
+	ch.entry = gtk_entry_new();
+	scrollable = gtk_scrolled_window_new(NULL, NULL);
+	ch.view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(ch.model));
+
+	/* Every row is as tall as the first, so none need measuring. */
+	cellr = bs_cell_renderer_entry_new();
+	g_object_set(cellr, "xpad", 3, "ypad", 3, NULL);
+	col = gtk_tree_view_column_new_with_attributes("Line", cellr,
+	    "name", 0, NULL);
+	gtk_tree_view_column_set_sizing(col, GTK_TREE_VIEW_COLUMN_FIXED);
+	gtk_tree_view_append_column(GTK_TREE_VIEW(ch.view), col);
+	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(ch.view), TRUE);
+	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(ch.view), FALSE);
+	gtk_tree_view_set_enable_search(GTK_TREE_VIEW(ch.view), FALSE);
+
+	gtk_widget_set_size_request(window, 400, 300);
+	g_object_set(box, "margin", 9, NULL);
+
+	gtk_container_add(GTK_CONTAINER(scrollable), ch.view);
+	gtk_box_pack_start(GTK_BOX(box), ch.entry, /* expand */ 0,
+	    /* fill */ 1, /* padding */ 3);
+	gtk_box_pack_start(GTK_BOX(box), scrollable, /* expand */ 1,
+	    /* fill */ 1, /* padding */ 3);
+
+	g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+	g_signal_connect(window, "response", G_CALLBACK(chooser_response), &ch);
+	g_signal_connect(ch.view, "row-activated",
+	    G_CALLBACK(chooser_activated), &ch);
+	g_signal_connect(ch.entry, "changed", G_CALLBACK(chooser_filter), &ch);
+	g_signal_connect(ch.entry, "activate",
+	    G_CALLBACK(chooser_entry_activated), &ch);
+	g_signal_connect(ch.entry, "key-press-event",
+	    G_CALLBACK(chooser_key_pressed), &ch);
+
+	/* Below drawing and input, so a fast producer cannot starve them. */
+	channel = g_io_channel_unix_new(STDIN_FILENO);
+	g_io_add_watch_full(channel, G_PRIORITY_LOW,
+	    G_IO_IN | G_IO_HUP | G_IO_ERR, chooser_read, &ch, NULL);
+	g_io_channel_unref(channel);
+
+	gtk_widget_show_all(window);
+	gtk_widget_grab_focus(ch.entry);
+
+	gtk_main();
+
+	g_string_free(ch.partial, TRUE);
+	g_object_unref(ch.model);
+
+	if (ch.chosen == NULL)
+		return 1;
+
+	puts(ch.chosen);
+	g_free(ch.chosen);
+	return fflush(stdout) == 0 ? 0 : 1;
+}
+
+/*
+ * Read one block from the standard input and append its lines. The last line
+ * is held back until it ends, or the input does.
+ */
+gboolean
+chooser_read(GIOChannel *source, GIOCondition condition, gpointer user_data)
+{
+	char		 buf[CHOOSER_BLOCK];
+	ssize_t		 n;
+	const char	*p, *nl, *end;
+	struct chooser	*ch;
+
+	ch = (struct chooser *)user_data;
+
+	if ((n = read(STDIN_FILENO, buf, sizeof(buf))) < 0) {
+		if (errno == EAGAIN || errno == EINTR)
+			return TRUE;
+		warn("read");
+		n = 0;
+	}
+
+	if (n == 0) {
+		chooser_append(ch, ch->partial->str, ch->partial->len);
+		g_string_truncate(ch->partial, 0);
+		return FALSE;
+	}
+
+	end = buf + n;
+	for (p = buf; (nl = memchr(p, '\n', end - p)) != NULL; p = nl + 1) {
+		if (ch->partial->len) {
+			g_string_append_len(ch->partial, p, nl - p);
+			chooser_append(ch, ch->partial->str, ch->partial->len);
+			g_string_truncate(ch->partial, 0);
+		} else
+			chooser_append(ch, p, nl - p);
+	}
+	g_string_append_len(ch->partial, p, end - p);
+
+	chooser_cursor_first(ch);
+	return TRUE;
+}
+
+/*
+ * Add a line to the model, unless it is blank.
+ */
+void
+chooser_append(struct chooser *ch, const char *line, gsize len)
+{
+	if (len)
+		bs_line_model_append(ch->model, line, len);
+}
+
+/*
+ * Show only the lines containing the typed text. The view is detached while
+ * the model changes, so that it is rebuilt once rather than row by row.
+ */
+void
+chooser_filter(GtkEditable *editable, gpointer user_data)
+{
+	struct chooser	*ch;
+
+	ch = (struct chooser *)user_data;
+
+	g_object_ref(ch->model);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(ch->view), NULL);
+	bs_line_model_set_filter(ch->model,
+	    gtk_entry_get_text(GTK_ENTRY(ch->entry)));
+	gtk_tree_view_set_model(GTK_TREE_VIEW(ch->view),
+	    GTK_TREE_MODEL(ch->model));
+	g_object_unref(ch->model);
+
+	chooser_cursor_first(ch);
+}
+
+/*
+ * Choose the line at the path, or the typed text if there is no such line,
+ * and quit.
+ */
+void
+chooser_choose(struct chooser *ch, GtkTreePath *path)
+{
+	const char	*text;
+	GtkTreeIter	 iter;
+
+	if (path && gtk_tree_model_get_iter(GTK_TREE_MODEL(ch->model), &iter,
+	    path))
+		ch->chosen = g_strdup(bs_line_model_get_line(ch->model,
+		    &iter));
+	else if (*(text = gtk_entry_get_text(GTK_ENTRY(ch->entry))))
+		ch->chosen = g_strdup(text);
+	else
+		return;
+
+	gtk_main_quit();
+}
+
+void
+chooser_activated(GtkTreeView *tree_view, GtkTreePath *path,
+    GtkTreeViewColumn *column, gpointer user_data)
+{
+	chooser_choose(user_data, path);
+}
+
+void
+chooser_response(GtkDialog *dialog, gint response_id, gpointer user_data)
+{
+	if (response_id == GTK_RESPONSE_OK)
+		chooser_entry_activated(NULL, user_data);
+	else
+		gtk_main_quit();
+}
+
+/*
+ * Choose the line under the cursor.
+ */
+void
+chooser_entry_activated(GtkEntry *entry, gpointer user_data)
+{
+	GtkTreePath	*path = NULL;
+	struct chooser	*ch;
+
+	ch = (struct chooser *)user_data;
+
+	gtk_tree_view_get_cursor(GTK_TREE_VIEW(ch->view), &path, NULL);
+	chooser_choose(ch, path);
+	if (path)
+		gtk_tree_path_free(path);
+}
+
+/*
+ * Move the cursor with the arrow keys while typing.
+ */
+gboolean
+chooser_key_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
+{
+	gint		 n, pos, step;
+	GtkTreePath	*path = NULL;
+	struct chooser	*ch;
+
+	ch = (struct chooser *)user_data;
+
+	switch (event->key.keyval) {
+	case GDK_KEY_Up:
+		step = -1;
+		break;
+	case GDK_KEY_Down:
+		step = 1;
+		break;
+	case GDK_KEY_Page_Up:
+		step = -10;
+		break;
+	case GDK_KEY_Page_Down:
+		step = 10;
+		break;
+	default:
+		return FALSE;
+	}
+
+	n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(ch->model), NULL);
+	if (n == 0)
+		return TRUE;
+
+	gtk_tree_view_get_cursor(GTK_TREE_VIEW(ch->view), &path, NULL);
+	pos = path ? gtk_tree_path_get_indices(path)[0] + step : 0;
+	if (path)
+		gtk_tree_path_free(path);
+
+	pos = CLAMP(pos, 0, n - 1);
+	path = gtk_tree_path_new_from_indices(pos, -1);
+	gtk_tree_view_set_cursor(GTK_TREE_VIEW(ch->view), path, NULL, FALSE);
+	gtk_tree_path_free(path);
+
+	return TRUE;
+}
+
+/*
+ * Put the cursor on the first row, if it is not on any.
+ */
+void
+chooser_cursor_first(struct chooser *ch)
+{
+	GtkTreePath	*path = NULL;
+
+	gtk_tree_view_get_cursor(GTK_TREE_VIEW(ch->view), &path, NULL);
+	if (path) {
+		gtk_tree_path_free(path);
+		return;
+	}
+
+	if (gtk_tree_model_iter_n_children(GTK_TREE_MODEL(ch->model), NULL)) {
+		path = gtk_tree_path_new_first();
+		gtk_tree_view_set_cursor(GTK_TREE_VIEW(ch->view), path, NULL,
+		    FALSE);
+		gtk_tree_path_free(path);
+	}
+}
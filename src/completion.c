@@ -0,0 +1,415 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * File name completion for the placeholder dialog. The directory of the path
+ * being typed is listed in the background, in batches, so the dialog never
+ * waits on a large or slow directory; typing into another directory cancels
+ * the listing. Finished listings are kept for the rest of the session.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "completion.h"
+#include "compat.h"
+
+#define COMPLETION_BATCH	256	/* Files per enumeration request */
+#define COMPLETION_KEEP		16	/* Directory listings kept */
+
+/*
+ * The completion state of one entry.
+ */
+struct completion {
+	GtkEntry	*entry;
+	GtkListStore	*store;		/* Candidate paths, as they would be typed */
+	char		*typed_dir;	/* The directory part of the listed path */
+	struct listing	*listing;	/* The listing in progress, or NULL */
+};
+
+/*
+ * A directory listing in progress. Once cancelled, it no longer refers to the
+ * completion, which may be gone.
+ */
+struct listing {
+	GCancellable	*cancel;
+	struct completion *c;
+	char		*dir;		/* The directory, as an absolute path */
+	char		*typed_dir;
+	GPtrArray	*names;		/* Directories end in a slash */
+};
+
+static void		 completion_free(gpointer);
+static void		 completion_changed(GtkEditable *, gpointer);
+static gboolean		 completion_match(GtkEntryCompletion *, const gchar *,
+    GtkTreeIter *, gpointer);
+static gboolean		 completion_selected(GtkEntryCompletion *,
+    GtkTreeModel *, GtkTreeIter *, gpointer);
+static const char	*completion_token(GtkEntry *);
+static char		*completion_dir(const char *);
+static void		 completion_add(struct completion *, const char *,
+    const char *);
+static void		 listing_start(struct completion *, const char *,
+    const char *);
+static void		 listing_enumerated(GObject *, GAsyncResult *, gpointer);
+static void		 listing_next(GObject *, GAsyncResult *, gpointer);
+static void		 listing_done(struct listing *);
+static void		 listing_free(struct listing *);
+
+static GHashTable	*listings = NULL;	/* Directory to GPtrArray */
+static GQueue		 recent = G_QUEUE_INIT;	/* Listed directories, oldest first */
+
+/*
+ * Complete file names in the entry.
+ */
+void
+path_completion_attach(GtkEntry *entry)
+{
+	GtkEntryCompletion	*ec;
+	struct completion	*c;
+
+	c = g_new0(struct completion, 1);
+	c->entry = entry;
+	c->store = gtk_list_store_new(1, G_TYPE_STRING);
+
+	ec = gtk_entry_completion_new();
+	gtk_entry_completion_set_model(ec, GTK_TREE_MODEL(c->store));
+	gtk_entry_completion_set_text_column(ec, 0);
+	gtk_entry_completion_set_match_func(ec, completion_match, c, NULL);
+	gtk_entry_completion_set_inline_selection(ec, TRUE);
+	g_signal_connect(ec, "match-selected",
+	    G_CALLBACK(completion_selected), c);
+	gtk_entry_set_completion(entry, ec);
+	g_object_unref(ec);
+
+	g_signal_connect(entry, "changed", G_CALLBACK(completion_changed), c);
+	g_object_set_data_full(G_OBJECT(entry), "path-completion", c,
+	    completion_free);
+
+	/* Start on the current directory before anything is typed. */
+	completion_changed(GTK_EDITABLE(entry), c);
+}
+
+void
+completion_free(gpointer data)
+{
+	struct completion	*c = data;
+
+	if (c->listing) {
+		g_cancellable_cancel(c->listing->cancel);
+		c->listing->c = NULL;
+	}
+	g_object_unref(c->store);
+	g_free(c->typed_dir);
+	g_free(c);
+}
+
+/*
+ * The text changed. If the path now names another directory, show its
+ * listing from the session, or start listing it.
+ */
+void
+completion_changed(GtkEditable *editable, gpointer user_data)
+{
+	guint			 i;
+	char			*typed_dir, *dir;
+	const char		*token, *slash;
+	GPtrArray		*names;
+	struct completion	*c = user_data;
+
+	token = completion_token(c->entry);
+	slash = strrchr(token, '/');
+	typed_dir = g_strndup(token, slash ? slash - token + 1 : 0);
+
+	if (c->typed_dir && strcmp(typed_dir, c->typed_dir) == 0) {
+		g_free(typed_dir);
+		return;
+	}
+
+	if (c->listing) {
+		g_cancellable_cancel(c->listing->cancel);
+		c->listing->c = NULL;
+		c->listing = NULL;
+	}
+	gtk_list_store_clear(c->store);
+	g_free(c->typed_dir);
+	c->typed_dir = typed_dir;
+
+	dir = completion_dir(typed_dir);
+	if (listings && (names = g_hash_table_lookup(listings, dir)) != NULL) {
+		for (i = 0; i < names->len; i++)
+			completion_add(c, typed_dir,
+			    g_ptr_array_index(names, i));
+	} else
+		listing_start(c, dir, typed_dir);
+	g_free(dir);
+}
+
+/*
+ * Whether the candidate completes the path being typed. The key is ignored,
+ * since it is the whole text and not just the path.
+ */
+gboolean
+completion_match(GtkEntryCompletion *ec, const gchar *key, GtkTreeIter *iter,
+    gpointer user_data)
+{
+	char			*candidate;
+	const char		*token;
+	gboolean		 match;
+	struct completion	*c = user_data;
+
+	token = completion_token(c->entry);
+	if (*token == '\0')
+		return FALSE;
+
+	gtk_tree_model_get(GTK_TREE_MODEL(c->store), iter, 0, &candidate, -1);
+	match = candidate && strcmp(candidate, token) != 0 &&
+	    g_str_has_prefix(candidate, token);
+	g_free(candidate);
+
+	return match;
+}
+
+/*
+ * Replace the path being typed with the chosen candidate.
+ */
+gboolean
+completion_selected(GtkEntryCompletion *ec, GtkTreeModel *model,
+    GtkTreeIter *iter, gpointer user_data)
+{
+	char			*candidate, *text;
+	const char		*all, *token;
+	struct completion	*c = user_data;
+
+	gtk_tree_model_get(model, iter, 0, &candidate, -1);
+	all = gtk_entry_get_text(c->entry);
+	token = completion_token(c->entry);
+
+	text = g_strdup_printf("%.*s%s", (int)(token - all), all, candidate);
+	gtk_entry_set_text(c->entry, text);
+	gtk_editable_set_position(GTK_EDITABLE(c->entry), -1);
+	g_free(text);
+	g_free(candidate);
+
+	return TRUE;
+}
+
+/*
+ * The path being typed: the text after the last space. Paths with spaces
+ * must be escaped or quoted anyway, and are only completed up to the space.
+ */
+const char *
+completion_token(GtkEntry *entry)
+{
+	const char	*text, *space;
+
+	text = gtk_entry_get_text(entry);
+	space = strrchr(text, ' ');
+
+	return space ? space + 1 : text;
+}
+
+/*
+ * The absolute path of a directory as typed, which may be empty for the
+ * current directory, start with a tilde, or be a file URI.
+ */
+char *
+completion_dir(const char *typed_dir)
+{
+	char	*cwd, *dir;
+
+	if (g_str_has_prefix(typed_dir, "file://"))
+		typed_dir += 7;
+
+	if (typed_dir[0] == '~' && (typed_dir[1] == '/' || !typed_dir[1]))
+		return g_build_filename(g_get_home_dir(), typed_dir + 1, NULL);
+	if (g_path_is_absolute(typed_dir))
+		return g_strdup(typed_dir);
+
+	cwd = g_get_current_dir();
+	dir = g_build_filename(cwd, typed_dir, NULL);
+	g_free(cwd);
+
+	return dir;
+}
+
+/*
+ * Add a file in the directory as a candidate.
+ */
+void
+completion_add(struct completion *c, const char *typed_dir, const char *name)
+{
+	char	*candidate;
+
+	candidate = g_strconcat(typed_dir, name, NULL);
+	gtk_list_store_insert_with_values(c->store, NULL, -1, 0, candidate, -1);
+	g_free(candidate);
+}
+
+/*
+ * Start listing the directory in the background.
+ */
+void
+listing_start(struct completion *c, const char *dir, const char *typed_dir)
+{
+	GFile		*file;
+	struct listing	*l;
+
+	l = g_new0(struct listing, 1);
+	l->cancel = g_cancellable_new();
+	l->c = c;
+	l->dir = g_strdup(dir);
+	l->typed_dir = g_strdup(typed_dir);
+	l->names = g_ptr_array_new_with_free_func(g_free);
+	c->listing = l;
+
+	file = g_file_new_for_path(dir);
+	g_file_enumerate_children_async(file,
+	    G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE,
+	    G_FILE_QUERY_INFO_NONE, G_PRIORITY_LOW, l->cancel,
+	    listing_enumerated, l);
+	g_object_unref(file);
+}
+
+/*
+ * The directory is open; ask for the first batch.
+ */
+void
+listing_enumerated(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	GFileEnumerator	*en;
+	struct listing	*l = user_data;
+
+	en = g_file_enumerate_children_finish(G_FILE(source), res, NULL);
+	if (en == NULL || l->c == NULL) {
+		if (en)
+			g_object_unref(en);
+		if (l->c)
+			l->c->listing = NULL;
+		listing_free(l);
+		return;
+	}
+
+	g_file_enumerator_next_files_async(en, COMPLETION_BATCH,
+	    G_PRIORITY_LOW, l->cancel, listing_next, l);
+}
+
+/*
+ * A batch of files has arrived. Offer them, and ask for the next batch until
+ * the directory is exhausted.
+ */
+void
+listing_next(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	char		*name;
+	GList		*infos, *i;
+	GError		*error = NULL;
+	GFileInfo	*info;
+	GFileEnumerator	*en = G_FILE_ENUMERATOR(source);
+	gboolean	 first;
+	struct listing	*l = user_data;
+
+	infos = g_file_enumerator_next_files_finish(en, res, &error);
+	if (l->c == NULL || error) {
+		if (l->c)
+			l->c->listing = NULL;
+		g_clear_error(&error);
+		g_list_free_full(infos, g_object_unref);
+		g_object_unref(en);
+		listing_free(l);
+		return;
+	}
+
+	if (infos == NULL) {
+		g_object_unref(en);
+		if (gtk_widget_has_focus(GTK_WIDGET(l->c->entry)))
+			gtk_entry_completion_complete(
+			    gtk_entry_get_completion(l->c->entry));
+		listing_done(l);
+		return;
+	}
+	first = l->names->len == 0;
+
+	for (i = infos; i; i = i->next) {
+		info = i->data;
+		if (g_file_info_get_file_type(info) == G_FILE_TYPE_DIRECTORY)
+			name = g_strconcat(g_file_info_get_name(info), "/",
+			    NULL);
+		else
+			name = g_strdup(g_file_info_get_name(info));
+		completion_add(l->c, l->typed_dir, name);
+		g_ptr_array_add(l->names, name);
+	}
+	g_list_free_full(infos, g_object_unref);
+
+	/*
+	 * Show what matches so far, but only once before the end: refiltering
+	 * after every batch would cost more the larger the directory.
+	 */
+	if (first && gtk_widget_has_focus(GTK_WIDGET(l->c->entry)))
+		gtk_entry_completion_complete(
+		    gtk_entry_get_completion(l->c->entry));
+
+	g_file_enumerator_next_files_async(en, COMPLETION_BATCH,
+	    G_PRIORITY_LOW, l->cancel, listing_next, l);
+}
+
+/*
+ * Keep a finished listing for the session, forgetting the oldest one if there
+ * are too many.
+ */
+void
+listing_done(struct listing *l)
+{
+	char	*oldest;
+
+	if (listings == NULL)
+		listings = g_hash_table_new_full(g_str_hash, g_str_equal,
+		    g_free, (GDestroyNotify)g_ptr_array_unref);
+
+	if (!g_hash_table_contains(listings, l->dir)) {
+		if (g_queue_get_length(&recent) >= COMPLETION_KEEP) {
+			oldest = g_queue_pop_head(&recent);
+			g_hash_table_remove(listings, oldest);
+			g_free(oldest);
+		}
+
+		g_hash_table_insert(listings, g_strdup(l->dir),
+		    g_ptr_array_ref(l->names));
+		g_queue_push_tail(&recent, g_strdup(l->dir));
+	}
+
+	l->c->listing = NULL;
+	listing_free(l);
+}
+
+void
+listing_free(struct listing *l)
+{
+	g_object_unref(l->cancel);
+	g_ptr_array_unref(l->names);
+	g_free(l->typed_dir);
+	g_free(l->dir);
+	g_free(l);
+}
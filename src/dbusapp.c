@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Launch DBusActivatable applications through the org.freedesktop.Application
+ * interface on the session bus. An application that is already running only
+ * has to open a window, and one that is not is started by the bus.
+ *
+ * The calls are made asynchronously, and given up on after DBUS_APP_TIMEOUT,
+ * so that a hung or slowly starting service does not hold up the window. A
+ * call that times out may still have started the application, so only a bus
+ * that has no such service at all means the Exec line should be run instead.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "dbusapp.h"
+#include "compat.h"
+
+#define DBUS_APP_TIMEOUT	5000	/* Milliseconds to wait for a reply */
+
+struct dbus_app_call {
+	char		*id;
+	dbus_app_func	 done;
+	gpointer	 data;
+};
+
+static char	*dbus_app_path(const char *);
+static void	 dbus_app_reply(GObject *, GAsyncResult *, gpointer);
+
+static guint	 calls = 0;	/* Calls not yet answered */
+
+/*
+ * Call Activate on the application with the given desktop ID, or Open if
+ * there are URIs, passing on the startup notification ID if there is one.
+ * The function is then called from the main loop with 1, or with 0 if there
+ * is no session bus or no service by that name, in which case it should run
+ * the Exec line instead.
+ */
+void
+dbus_app_activate(const char *id, char **uris, const char *startup_id,
+    dbus_app_func done, gpointer data)
+{
+	char			*path;
+	GError			*error = NULL;
+	GVariant		*params;
+	GVariantBuilder		 platform_data;
+	GDBusConnection		*bus;
+	struct dbus_app_call	*call;
+
+	if (!g_dbus_is_name(id) || g_dbus_is_unique_name(id)) {
+		done(0, data);
+		return;
+	}
+
+	if ((bus = g_bus_get_sync(G_BUS_TYPE_SESSION, NULL, &error)) == NULL) {
+		warnx("g_bus_get_sync: %s", error->message);
+		g_clear_error(&error);
+		done(0, data);
+		return;
+	}
+
+	g_variant_builder_init(&platform_data, G_VARIANT_TYPE_VARDICT);
+	if (startup_id)
+		g_variant_builder_add(&platform_data, "{sv}",
+		    "desktop-startup-id", g_variant_new_string(startup_id));
+	if (uris)
+		params = g_variant_new("(^as@a{sv})", uris,
+		    g_variant_builder_end(&platform_data));
+	else
+		params = g_variant_new("(@a{sv})",
+		    g_variant_builder_end(&platform_data));
+
+	if ((call = malloc(sizeof(struct dbus_app_call))) == NULL)
+		err(1, NULL);
+	call->id = g_strdup(id);
+	call->done = done;
+	call->data = data;
+	calls++;
+
+	path = dbus_app_path(id);
+	g_dbus_connection_call(bus, id, path,
+	    "org.freedesktop.Application", uris ? "Open" : "Activate", params,
+	    NULL, G_DBUS_CALL_FLAGS_NONE, DBUS_APP_TIMEOUT, NULL,
+	    dbus_app_reply, call);
+	g_free(path);
+	g_object_unref(bus);
+}
+
+/*
+ * Hand the outcome of a call to its function. Any error but the bus not
+ * knowing the name, such as a timeout or the application failing the call,
+ * counts as launched, since running the Exec line as well could start it
+ * twice.
+ */
+void
+dbus_app_reply(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+	int			 launched = 1;
+	GError			*error = NULL;
+	GVariant		*ret;
+	struct dbus_app_call	*call = user_data;
+
+	ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source), res,
+	    &error);
+	if (ret == NULL) {
+		warnx("%s: %s", call->id, error->message);
+		if (g_error_matches(error, G_DBUS_ERROR,
+		    G_DBUS_ERROR_SERVICE_UNKNOWN) ||
+		    g_error_matches(error, G_DBUS_ERROR,
+		    G_DBUS_ERROR_NAME_HAS_NO_OWNER))
+			launched = 0;
+		g_clear_error(&error);
+	} else
+		g_variant_unref(ret);
+
+	call->done(launched, call->data);
+
+	calls--;
+	g_free(call->id);
+	free(call);
+}
+
+/*
+ * Run the main loop until every call has been answered or timed out.
+ */
+void
+dbus_app_wait(void)
+{
+	while (calls > 0)
+		g_main_context_iteration(NULL, TRUE);
+}
+
+/*
+ * The object path for a desktop ID: a slash in front, and then each dot
+ * replaced with a slash and each dash with an underscore.
+ */
+char *
+dbus_app_path(const char *id)
+{
+	char	*path, *p;
+
+	path = g_strconcat("/", id, NULL);
+	for (p = path; *p; p++)
+		if (*p == '.')
+			*p = '/';
+		else if (*p == '-')
+			*p = '_';
+
+	return path;
+}
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * OnlyShowIn and NotShowIn. Desktop names from the freedesktop.org registry
+ * are turned into bits, both in the entries and in $XDG_CURRENT_DESKTOP, so
+ * that deciding whether an entry is shown is a single AND. Other names are
+ * kept as strings and only compared when the current desktop has such a name
+ * too.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "desktop.h"
+#include "compat.h"
+
+static void	 desktop_init(void);
+static int	 desktop_other_matches(const char *);
+
+static const char *known[] = {
+	"Budgie", "Cinnamon", "DDE", "EDE", "Endless", "Enlightenment",
+	"GNOME", "GNOME-Classic", "GNOME-Flashback", "KDE", "LXDE", "LXQt",
+	"MATE", "Old", "Pantheon", "Razor", "ROX", "TDE", "Unity", "XFCE",
+};
+
+static int	  initialized = 0;
+static uint32_t	  current = 0;		/* Known desktops in use */
+static gchar	**current_other = NULL;	/* Unknown desktops in use */
+
+/*
+ * The bits for a list of desktop names. Names not in the registry are joined
+ * with semicolons into a new string in other, which is NULL if there are none.
+ */
+uint32_t
+desktop_mask(char **names, char **other)
+{
+	size_t		 i;
+	uint32_t	 mask = 0;
+	GString		*s = NULL;
+
+	for (; names && *names; names++) {
+		for (i = 0; i < G_N_ELEMENTS(known); i++)
+			if (strcmp(*names, known[i]) == 0)
+				break;
+
+		if (i < G_N_ELEMENTS(known)) {
+			mask |= 1u << i;
+			continue;
+		}
+
+		if (s == NULL)
+			s = g_string_new(NULL);
+		g_string_append(s, *names);
+		g_string_append_c(s, ';');
+	}
+
+	*other = s ? g_string_free(s, FALSE) : NULL;
+	return mask;
+}
+
+/*
+ * Whether the entry is shown in the current desktop.
+ */
+int
+desktop_shows(const struct entry *e)
+{
+	desktop_init();
+
+	if ((e->only_in || e->only_in_other) && (e->only_in & current) == 0 &&
+	    !desktop_other_matches(e->only_in_other))
+		return 0;
+
+	if ((e->not_in & current) || desktop_other_matches(e->not_in_other))
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Parse $XDG_CURRENT_DESKTOP, once.
+ */
+void
+desktop_init(void)
+{
+	char		*other;
+	gchar		**names;
+	const char	*env;
+
+	if (initialized)
+		return;
+	initialized = 1;
+
+	if ((env = getenv("XDG_CURRENT_DESKTOP")) == NULL || !*env)
+		return;
+
+	names = g_strsplit(env, ":", -1);
+	current = desktop_mask(names, &other);
+	g_strfreev(names);
+
+	if (other) {
+		current_other = g_strsplit(other, ";", -1);
+		g_free(other);
+	}
+}
+
+/*
+ * Whether any of the semicolon-separated unknown desktop names is in use.
+ */
+int
+desktop_other_matches(const char *other)
+{
+	gchar		**cur;
+	const char	 *p;
+	size_t		  len;
+
+	if (other == NULL || current_other == NULL)
+		return 0;
+
+	for (cur = current_other; *cur; cur++) {
+		if ((len = strlen(*cur)) == 0)
+			continue;
+		for (p = other; (p = strstr(p, *cur)) != NULL; p += len)
+			if ((p == other || p[-1] == ';') && p[len] == ';')
+				return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "entry.h"
+#include "compat.h"
+
+static int	entry_streq(const char *, const char *);
+
+/*
+ * Identify which field code placeholders are used in the exec statement.
+ */
+uint8_t
+field_codes(const char *cmd)
+{
+	uint8_t	flags = 0, found_percent = 0;
+
+	for (; *cmd; cmd++) {
+		switch (*cmd) {
+		case '%':
+			found_percent = !found_percent;
+			break;
+		case 'f':
+			if (found_percent)
+				flags |= SINGLE_FILE_PLACEHOLDER;
+			found_percent = 0;
+			break;
+		case 'F':
+			if (found_percent)
+				flags |= MULTI_FILE_PLACEHOLDER;
+			found_percent = 0;
+			break;
+		case 'u':
+			if (found_percent)
+				flags |= SINGLE_URL_PLACEHOLDER;
+			found_percent = 0;
+			break;
+		case 'U':
+			if (found_percent)
+				flags |= MULTI_URL_PLACEHOLDER;
+			found_percent = 0;
+			break;
+		}
+	}
+
+	return flags;
+}
+
+/*
+ * The desktop file ID of an entry: the basename of its file, or its name if
+ * it did not come from a file.
+ */
+const char *
+entry_id(const struct entry *e)
+{
+	const char	*slash;
+
+	if (e->file == NULL)
+		return e->name;
+
+	slash = strrchr(e->file, '/');
+	return slash ? slash + 1 : e->file;
+}
+
+/*
+ * Whether two entries are the same in every field.
+ */
+int
+entry_equal(const struct entry *a, const struct entry *b)
+{
+	return entry_streq(a->name, b->name) &&
+	    entry_streq(a->exec, b->exec) &&
+	    entry_streq(a->icon, b->icon) &&
+	    entry_streq(a->collate, b->collate) &&
+	    entry_streq(a->generic, b->generic) &&
+	    entry_streq(a->keywords, b->keywords) &&
+	    entry_streq(a->comment, b->comment) &&
+	    entry_streq(a->tryexec, b->tryexec) &&
+	    entry_streq(a->only_in_other, b->only_in_other) &&
+	    entry_streq(a->not_in_other, b->not_in_other) &&
+	    entry_streq(a->file, b->file) &&
+	    entry_streq(a->wmclass, b->wmclass) &&
+	    entry_streq(a->mimetypes, b->mimetypes) &&
+	    a->only_in == b->only_in &&
+	    a->not_in == b->not_in &&
+	    a->fcodes == b->fcodes &&
+	    a->use_term == b->use_term &&
+	    a->hidden == b->hidden &&
+	    a->has_actions == b->has_actions &&
+	    a->dbus == b->dbus &&
+	    a->startup_notify == b->startup_notify &&
+	    a->shadowed == b->shadowed;
+}
+
+/*
+ * Compare two strings that may be NULL.
+ */
+int
+entry_streq(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return a == b;
+
+	return strcmp(a, b) == 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _ENTRY_H
+#define _ENTRY_H
+
+#include <stdint.h>
+
+enum field_code {
+	NO_PLACEHOLDER = 1 << 0,
+	SINGLE_FILE_PLACEHOLDER = 1 << 1,
+	MULTI_FILE_PLACEHOLDER = 1 << 2,
+	SINGLE_URL_PLACEHOLDER = 1 << 3,
+	MULTI_URL_PLACEHOLDER = 1 << 4,
+};
+
+/*
+ * The parts of a desktop entry that we use, with any localized strings
+ * already resolved.
+ */
+struct entry {
+	const char	*name;		/* Localized Name */
+	const char	*exec;		/* Exec, or NULL if hidden */
+	const char	*icon;		/* Icon, or NULL */
+	const char	*collate;	/* Collation key of the name */
+	const char	*generic;	/* Localized GenericName, or NULL */
+	const char	*keywords;	/* Localized Keywords, or NULL */
+	const char	*comment;	/* Localized Comment, or NULL */
+	const char	*tryexec;	/* TryExec, or NULL */
+	const char	*only_in_other;	/* Unknown OnlyShowIn names, or NULL */
+	const char	*not_in_other;	/* Unknown NotShowIn names, or NULL */
+	const char	*file;		/* The desktop file, or NULL */
+	const char	*wmclass;	/* StartupWMClass, or NULL */
+	const char	*mimetypes;	/* MimeType, or NULL */
+	uint32_t	 only_in;	/* OnlyShowIn, as desktop bits */
+	uint32_t	 not_in;	/* NotShowIn, as desktop bits */
+	uint8_t		 fcodes;	/* Field codes found in the exec */
+	uint8_t		 use_term;	/* Whether to run it in a terminal */
+	uint8_t		 hidden;	/* Only shadows other entries by ID */
+	uint8_t		 has_actions;	/* Whether it lists Actions */
+	uint8_t		 dbus;		/* DBusActivatable */
+	uint8_t		 startup_notify;	/* StartupNotify */
+	uint8_t		 shadowed;	/* Not parsed; its ID was already seen */
+};
+
+uint8_t		 field_codes(const char *);
+const char	*entry_id(const struct entry *);
+int		 entry_equal(const struct entry *, const struct entry *);
+
+#endif /* _ENTRY_H */
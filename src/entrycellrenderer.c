@@ -20,8 +20,6 @@
 #include <config.h>
 #endif
 
-#include <sys/stat.h>
-
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -29,7 +27,10 @@
 
 #include <gtk/gtk.h>
 
+#include "atlas.h"
 #include "entrycellrenderer.h"
+#include "icontheme.h"
+#include "metrics.h"
 #include "compat.h"
 
 #define CELL_HEIGHT 32
@@ -39,17 +40,21 @@ enum {
 	PROP_NAME,
 	PROP_EXEC,
 	PROP_ICON,
+	PROP_COMPACT,
 	NUM_PROPS,
 };
 
 struct _BsCellRendererEntryPrivate {
-	char	*name;
-	char	*exec;
-	char	*icon;
+	char		*name;
+	char		*exec;
+	char		*icon;
+	gboolean	 compact;	/* One line of text and no icon */
+	gint		 line_height;	/* The height of that line, once measured */
 };
 
 static void	bs_cell_renderer_entry_class_init(BsCellRendererEntryClass *);
 static void	bs_cell_renderer_entry_init(BsCellRendererEntry *);
+static void	bs_cell_renderer_entry_finalize(GObject *);
 static void	bs_cell_renderer_entry_get_property(GObject *, guint, GValue *,
     GParamSpec *);
 static void	bs_cell_renderer_entry_set_property(GObject *, guint,
@@ -59,8 +64,15 @@ static void	bs_cell_renderer_entry_get_size(GtkCellRenderer *,
 static void	bs_cell_renderer_entry_render(GtkCellRenderer *,
     cairo_t *, GtkWidget *, const GdkRectangle *,
     const GdkRectangle *, GtkCellRendererState);
+static void	bs_cell_renderer_entry_render_line(GtkCellRenderer *,
+    cairo_t *, GtkWidget *, const GdkRectangle *);
+static gboolean	low_bandwidth(void);
 char		*resolve_icon(char *);
 
+static guint64	render_count = 0;	/* Rows rendered by all instances */
+static GHashTable *resolved = NULL;	/* Icon name to file name, or "" */
+static guint	resolved_generation;	/* Icon theme they were resolved in */
+
 G_DEFINE_TYPE_WITH_PRIVATE(
     BsCellRendererEntry, bs_cell_renderer_entry, GTK_TYPE_CELL_RENDERER)
 
@@ -75,6 +87,7 @@ bs_cell_renderer_entry_class_init(BsCellRendererEntryClass *klass)
 
 	object_class->get_property = bs_cell_renderer_entry_get_property;
 	object_class->set_property = bs_cell_renderer_entry_set_property;
+	object_class->finalize = bs_cell_renderer_entry_finalize;
 
 	cell_class->get_size = bs_cell_renderer_entry_get_size;
 	cell_class->render = bs_cell_renderer_entry_render;
@@ -96,6 +109,13 @@ bs_cell_renderer_entry_class_init(BsCellRendererEntryClass *klass)
 	    PROP_ICON,
 	    g_param_spec_string("icon", "Icon", "The Icon from the entry",
 		    NULL, G_PARAM_READWRITE|G_PARAM_EXPLICIT_NOTIFY));
+
+	/* property: "compact" */
+	g_object_class_install_property(object_class,
+	    PROP_COMPACT,
+	    g_param_spec_boolean("compact", "Compact",
+		    "Draw one line of text and no icon", FALSE,
+		    G_PARAM_READWRITE|G_PARAM_EXPLICIT_NOTIFY));
 }
 
 static void
@@ -105,6 +125,21 @@ bs_cell_renderer_entry_init(BsCellRendererEntry *cell)
 	cell->priv->name = NULL;
 	cell->priv->exec = NULL;
 	cell->priv->icon = NULL;
+	cell->priv->compact = low_bandwidth();
+	cell->priv->line_height = 0;
+}
+
+static void
+bs_cell_renderer_entry_finalize(GObject *object)
+{
+	BsCellRendererEntryPrivate	*priv;
+
+	priv = BS_CELL_RENDERER_ENTRY(object)->priv;
+	free(priv->name);
+	free(priv->exec);
+	free(priv->icon);
+
+	G_OBJECT_CLASS(bs_cell_renderer_entry_parent_class)->finalize(object);
 }
 
 GtkCellRenderer *
@@ -113,6 +148,15 @@ bs_cell_renderer_entry_new(void)
 	return g_object_new(BS_TYPE_CELL_RENDERER_ENTRY, NULL);
 }
 
+/*
+ * The number of rows rendered so far, for benchmarks.
+ */
+guint64
+bs_cell_renderer_entry_get_render_count(void)
+{
+	return render_count;
+}
+
 static void
 bs_cell_renderer_entry_get_property(GObject *object, guint param_id,
     GValue *value, GParamSpec *pspec)
@@ -133,6 +177,9 @@ bs_cell_renderer_entry_get_property(GObject *object, guint param_id,
 	case PROP_ICON:
 		g_value_set_string(value, priv->icon);
 		break;
+	case PROP_COMPACT:
+		g_value_set_boolean(value, priv->compact);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, param_id, pspec);
 	}
@@ -161,7 +208,15 @@ bs_cell_renderer_entry_set_property(GObject *object, guint param_id,
 		break;
 	case PROP_ICON:
 		free(priv->icon);
-		priv->icon = resolve_icon(g_value_dup_string(value));
+		/* Compact rows never show the icon, so never look it up. */
+		if (priv->compact)
+			priv->icon = NULL;
+		else
+			priv->icon = resolve_icon(g_value_dup_string(value));
+		g_object_notify_by_pspec(object, pspec);
+		break;
+	case PROP_COMPACT:
+		priv->compact = g_value_get_boolean(value);
 		g_object_notify_by_pspec(object, pspec);
 		break;
 	default:
@@ -174,12 +229,22 @@ bs_cell_renderer_entry_get_size(GtkCellRenderer *cell,
     GtkWidget *widget, const GdkRectangle *cell_area, gint *x_offset,
     gint *y_offset, gint *width, gint *height)
 {
-	int32_t	xpad, ypad;
+	int32_t				 xpad, ypad;
+	BsCellRendererEntryPrivate	*priv;
+	PangoLayout			*layout;
 
+	priv = BS_CELL_RENDERER_ENTRY(cell)->priv;
 	g_object_get(cell, "xpad", &xpad, "ypad", &ypad, NULL);
 
+	if (priv->compact && priv->line_height == 0) {
+		layout = gtk_widget_create_pango_layout(widget, "Xy");
+		pango_layout_get_pixel_size(layout, NULL, &priv->line_height);
+		g_object_unref(layout);
+	}
+
 	if (height)
-		*height = CELL_HEIGHT + 2 * ypad;
+		*height = (priv->compact ? priv->line_height : CELL_HEIGHT) +
+		    2 * ypad;
 	if (width)
 		*width = 300 + 2 * xpad;
 }
@@ -191,6 +256,7 @@ bs_cell_renderer_entry_render(GtkCellRenderer *cellr, cairo_t *cr,
 {
 	int32_t		 		 name_width, name_height;
 	int32_t				 xpad, ypad, icon_offset = CELL_HEIGHT;
+	gboolean			 sensitive;
 	BsCellRendererEntry		*cell;
 	BsCellRendererEntryPrivate	*priv;
 	GtkStyleContext			*style_ctx;
@@ -198,11 +264,17 @@ bs_cell_renderer_entry_render(GtkCellRenderer *cellr, cairo_t *cr,
 	PangoLayout			*name_layout, *cmd_layout;
 	PangoAttrList			*list;
 	PangoAttribute			*attr;
-	GdkPixbuf			*icon = NULL;
-	GError				*error = NULL;
+	struct atlas			*atlas;
 
 	cell = BS_CELL_RENDERER_ENTRY(cellr);
 	priv = cell->priv;
+	render_count++;
+
+	if (priv->compact) {
+		bs_cell_renderer_entry_render_line(cellr, cr, widget,
+		    cell_area);
+		return;
+	}
 
 	style_ctx = gtk_widget_get_style_context(widget);
 	pango_ctx = gtk_widget_get_pango_context(widget);
@@ -213,8 +285,12 @@ bs_cell_renderer_entry_render(GtkCellRenderer *cellr, cairo_t *cr,
 
 	g_object_get(cellr, "xpad", &xpad, "ypad", &ypad, NULL);
 
+	/* Insensitive rows, such as those that cannot take a drop, are dim. */
+	if (!(sensitive = gtk_cell_renderer_get_sensitive(cellr)))
+		cairo_push_group(cr);
+
 	pango_layout_set_text(name_layout, priv->name, -1);
-	pango_layout_set_text(cmd_layout, priv->exec, -1);
+	pango_layout_set_text(cmd_layout, priv->exec ? priv->exec : "", -1);
 	pango_layout_get_pixel_size(name_layout, &name_width, &name_height);
 
 	attr->start_index = 0;
@@ -222,12 +298,12 @@ bs_cell_renderer_entry_render(GtkCellRenderer *cellr, cairo_t *cr,
 	pango_attr_list_insert(list, attr);
 	pango_layout_set_attributes(name_layout, list);
 
-	if (priv->icon)
-		icon = gdk_pixbuf_new_from_file_at_size(priv->icon,
-		    CELL_HEIGHT, -1, &error);
-	if (icon)
-		gtk_render_icon(style_ctx, cr, icon, cell_area->x + xpad,
+	if (priv->icon) {
+		atlas = atlas_get(CELL_HEIGHT,
+		    gtk_widget_get_scale_factor(widget));
+		atlas_paint(atlas, cr, priv->icon, cell_area->x + xpad,
 		    cell_area->y + ypad);
+	}
 
 	gtk_render_layout(style_ctx, cr,
 	    icon_offset + xpad + cell_area->x + xpad,
@@ -236,30 +312,141 @@ bs_cell_renderer_entry_render(GtkCellRenderer *cellr, cairo_t *cr,
 	    icon_offset + xpad + cell_area->x + xpad,
 	    cell_area->y + name_height + ypad, cmd_layout);
 
+	if (!sensitive) {
+		cairo_pop_group_to_source(cr);
+		cairo_paint_with_alpha(cr, 0.35);
+	}
+
+	pango_attr_list_unref(list);
+	g_object_unref(cmd_layout);
+	g_object_unref(name_layout);
+}
+
+/*
+ * Draw the entry as one line: the name in bold, then the command, cut short
+ * to fit.
+ */
+static void
+bs_cell_renderer_entry_render_line(GtkCellRenderer *cellr, cairo_t *cr,
+    GtkWidget *widget, const GdkRectangle *cell_area)
+{
+	char				*text;
+	int32_t				 xpad, ypad;
+	gboolean			 sensitive;
+	BsCellRendererEntryPrivate	*priv;
+	PangoLayout			*layout;
+	PangoAttrList			*list;
+	PangoAttribute			*attr;
+
+	priv = BS_CELL_RENDERER_ENTRY(cellr)->priv;
+	g_object_get(cellr, "xpad", &xpad, "ypad", &ypad, NULL);
+
+	if (!(sensitive = gtk_cell_renderer_get_sensitive(cellr)))
+		cairo_push_group(cr);
+
+	text = g_strconcat(priv->name, "  ", priv->exec ? priv->exec : "",
+	    NULL);
+	layout = gtk_widget_create_pango_layout(widget, text);
+	pango_layout_set_width(layout,
+	    MAX(cell_area->width - 2 * xpad, 0) * PANGO_SCALE);
+	pango_layout_set_ellipsize(layout, PANGO_ELLIPSIZE_END);
+
+	attr = pango_attr_weight_new(PANGO_WEIGHT_BOLD);
+	attr->start_index = 0;
+	attr->end_index = strlen(priv->name);
+	list = pango_attr_list_new();
+	pango_attr_list_insert(list, attr);
+	pango_layout_set_attributes(layout, list);
+
+	gtk_render_layout(gtk_widget_get_style_context(widget), cr,
+	    cell_area->x + xpad, cell_area->y + ypad, layout);
+
+	if (!sensitive) {
+		cairo_pop_group_to_source(cr);
+		cairo_paint_with_alpha(cr, 0.35);
+	}
+
 	pango_attr_list_unref(list);
+	g_object_unref(layout);
+	g_free(text);
+}
+
+/*
+ * Whether to draw compact rows by default: when $BYTESTREAM_COMPACT says so,
+ * or else when the X display is reached over the network, as with ssh -X.
+ * Icons and tall rows are costly to send there.
+ */
+static gboolean
+low_bandwidth(void)
+{
+	static int	 compact = -1;
+	const char	*env, *colon;
+	size_t		 len;
+
+	if (compact != -1)
+		return compact;
+
+	if ((env = getenv("BYTESTREAM_COMPACT")) != NULL && *env)
+		compact = strcmp(env, "0") != 0;
+	else if ((env = getenv("DISPLAY")) == NULL ||
+	    (colon = strrchr(env, ':')) == NULL)
+		compact = 0;
+	else {
+		/* ":0" and "unix:0" are local; any host name is not. */
+		len = colon - env;
+		compact = len > 0 && !(len == 4 && strncmp(env, "unix", 4) == 0);
+	}
+
+	return compact;
 }
 
+/*
+ * Turn the Icon from a desktop entry into a file name, taking ownership of the
+ * name. Icon theme caches are used when they exist; GTK is only asked when
+ * part of the theme is not cached, or for names that look like file names,
+ * which no cache has. Rows are resolved on every draw, so the answers,
+ * misses included, are kept until the icon theme is reloaded.
+ */
 char *
 resolve_icon(char *name)
 {
 	char		*fn;
-	struct stat	sb;
+	const char	*kept;
+	guint		 gen;
 	GtkIconInfo	*info;
 
 	if (!name)
 		return NULL;
 
-	if (stat(name, &sb) == 0)
+	if (*name == '/')
 		return name;
 
-	info = gtk_icon_theme_lookup_icon(gtk_icon_theme_get_default(), name,
-	    CELL_HEIGHT, 0);
-
-	if (info) {
-		fn = strdup(gtk_icon_info_get_filename(info));
-		g_object_unref(info);
+	gen = icon_theme_generation();
+	if (resolved == NULL)
+		resolved = g_hash_table_new_full(g_str_hash, g_str_equal,
+		    g_free, g_free);
+	else if (gen != resolved_generation)
+		g_hash_table_remove_all(resolved);
+	resolved_generation = gen;
+
+	if ((kept = g_hash_table_lookup(resolved, name)) != NULL) {
+		fn = *kept ? strdup(kept) : NULL;
+		free(name);
 		return fn;
 	}
 
-	return NULL;
+	fn = icon_theme_lookup(name, CELL_HEIGHT, 1);
+	metrics_add(fn ? METRIC_ICON_CACHE_HITS : METRIC_ICON_CACHE_MISSES, 1);
+	if (fn == NULL &&
+	    (!icon_theme_is_complete() || strpbrk(name, "./") != NULL)) {
+		info = gtk_icon_theme_lookup_icon(gtk_icon_theme_get_default(),
+		    name, CELL_HEIGHT, 0);
+		if (info) {
+			fn = strdup(gtk_icon_info_get_filename(info));
+			g_object_unref(info);
+		}
+	}
+
+	g_hash_table_insert(resolved, name, g_strdup(fn ? fn : ""));
+	return fn;
 }
@@ -39,6 +39,7 @@ struct _BsCellRendererEntryClass {
 
 GType		 bs_cell_renderer_entry_get_type(void);
 GtkCellRenderer	*bs_cell_renderer_entry_new(void);
+guint64		 bs_cell_renderer_entry_get_render_count(void);
 
 G_END_DECLS
 
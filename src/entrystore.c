@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * The rows of the list, laid out by field rather than by entry. The names,
+ * commands, and collation keys of every row are copied back to back into one
+ * string blob and found by offset, and the field codes and terminal flag are
+ * packed into one byte per row, so that a pass over every row, as when
+ * sorting or looking up a name, reads each array front to back instead of
+ * following pointers into the caches.
+ *
+ * A row's id is its index; rows are never removed, only no longer shown, and
+ * are replaced in place when their entry is read again.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "entrystore.h"
+#include "compat.h"
+
+/* Set in the packed flags of rows run in a terminal. */
+#define TERM_FLAG	(1 << 7)
+
+struct entry_store {
+	GString		*blob;		/* Every string, NUL-terminated */
+	GArray		*names;		/* Offset of the name, by row */
+	GArray		*name_lens;	/* Length of the name, by row */
+	GArray		*execs;		/* Offset of the command, by row */
+	GArray		*collates;	/* Offset of the collation key */
+	GByteArray	*flags;		/* Field codes and TERM_FLAG, by row */
+	GPtrArray	*entries;	/* The entry, by row */
+	guint		 changes;	/* Rows replaced so far */
+};
+
+static guint32	 entry_store_intern(struct entry_store *, const char *);
+static guint8	 entry_store_flags(const struct entry *);
+
+/*
+ * An empty store.
+ */
+struct entry_store *
+entry_store_new(void)
+{
+	struct entry_store	*s;
+
+	if ((s = calloc(1, sizeof(struct entry_store))) == NULL)
+		err(1, NULL);
+
+	s->blob = g_string_sized_new(4096);
+	s->names = g_array_new(FALSE, FALSE, sizeof(guint32));
+	s->name_lens = g_array_new(FALSE, FALSE, sizeof(guint32));
+	s->execs = g_array_new(FALSE, FALSE, sizeof(guint32));
+	s->collates = g_array_new(FALSE, FALSE, sizeof(guint32));
+	s->flags = g_byte_array_new();
+	s->entries = g_ptr_array_new();
+
+	return s;
+}
+
+/*
+ * Free the store. The entries themselves belong to the caches.
+ */
+void
+entry_store_free(struct entry_store *s)
+{
+	if (s) {
+		g_string_free(s->blob, TRUE);
+		g_array_free(s->names, TRUE);
+		g_array_free(s->name_lens, TRUE);
+		g_array_free(s->execs, TRUE);
+		g_array_free(s->collates, TRUE);
+		g_byte_array_free(s->flags, TRUE);
+		g_ptr_array_free(s->entries, TRUE);
+		free(s);
+	}
+}
+
+/*
+ * Add a row for the entry, which must outlive the store. Returns the row's id.
+ */
+guint
+entry_store_add(struct entry_store *s, const struct entry *e)
+{
+	guint32	off, len;
+	guint8	flags;
+
+	len = strlen(e->name);
+	off = entry_store_intern(s, e->name);
+	g_array_append_val(s->names, off);
+	g_array_append_val(s->name_lens, len);
+
+	off = entry_store_intern(s, e->exec ? e->exec : "");
+	g_array_append_val(s->execs, off);
+
+	off = entry_store_intern(s, e->collate ? e->collate : "");
+	g_array_append_val(s->collates, off);
+
+	flags = entry_store_flags(e);
+	g_byte_array_append(s->flags, &flags, 1);
+
+	g_ptr_array_add(s->entries, (gpointer)e);
+
+	return s->entries->len - 1;
+}
+
+/*
+ * Make a row that of a newer reading of its entry, keeping its id. The old
+ * strings are left in the blob.
+ */
+void
+entry_store_replace(struct entry_store *s, guint id, const struct entry *e)
+{
+	g_array_index(s->names, guint32, id) = entry_store_intern(s, e->name);
+	g_array_index(s->name_lens, guint32, id) = strlen(e->name);
+	g_array_index(s->execs, guint32, id) =
+	    entry_store_intern(s, e->exec ? e->exec : "");
+	g_array_index(s->collates, guint32, id) =
+	    entry_store_intern(s, e->collate ? e->collate : "");
+	s->flags->data[id] = entry_store_flags(e);
+	g_ptr_array_index(s->entries, id) = (gpointer)e;
+
+	s->changes++;
+}
+
+/*
+ * The packed flags of an entry. The field codes take the low bits; see
+ * field_codes().
+ */
+guint8
+entry_store_flags(const struct entry *e)
+{
+	guint8	flags;
+
+	flags = e->fcodes;
+	if (e->use_term)
+		flags |= TERM_FLAG;
+	return flags;
+}
+
+/*
+ * Copy a string onto the end of the blob, returning its offset.
+ */
+guint32
+entry_store_intern(struct entry_store *s, const char *str)
+{
+	guint32	off;
+
+	off = s->blob->len;
+	g_string_append_len(s->blob, str, strlen(str) + 1);
+	return off;
+}
+
+/*
+ * The number of rows.
+ */
+guint
+entry_store_len(struct entry_store *s)
+{
+	return s->entries->len;
+}
+
+/*
+ * The entry of a row.
+ */
+const struct entry *
+entry_store_entry(struct entry_store *s, guint id)
+{
+	return g_ptr_array_index(s->entries, id);
+}
+
+/*
+ * How many rows have been replaced, so that what was worked out from the
+ * rows can be told apart from what is now in them.
+ */
+guint
+entry_store_changes(struct entry_store *s)
+{
+	return s->changes;
+}
+
+/*
+ * The command of a row, or the empty string. Like all strings from the store,
+ * it is only good until the next row is added or replaced.
+ */
+const char *
+entry_store_exec(struct entry_store *s, guint id)
+{
+	return s->blob->str + g_array_index(s->execs, guint32, id);
+}
+
+/*
+ * The field codes in the command of a row.
+ */
+uint8_t
+entry_store_fcodes(struct entry_store *s, guint id)
+{
+	return s->flags->data[id] & ~TERM_FLAG;
+}
+
+/*
+ * Whether a row is run in a terminal.
+ */
+int
+entry_store_term(struct entry_store *s, guint id)
+{
+	return (s->flags->data[id] & TERM_FLAG) != 0;
+}
+
+/*
+ * Order two rows by their collation keys.
+ */
+int
+entry_store_compare(struct entry_store *s, guint a, guint b)
+{
+	return strcmp(s->blob->str + g_array_index(s->collates, guint32, a),
+	    s->blob->str + g_array_index(s->collates, guint32, b));
+}
+
+/*
+ * The first row from the given one on that is named exactly name, or the
+ * number of rows if there is none. Only names of the same length are
+ * compared.
+ */
+guint
+entry_store_find(struct entry_store *s, const char *name, guint from)
+{
+	guint		 id;
+	guint32		 len, *lens, *names;
+
+	len = strlen(name);
+	lens = (guint32 *)s->name_lens->data;
+	names = (guint32 *)s->names->data;
+
+	for (id = from; id < s->name_lens->len; id++)
+		if (lens[id] == len &&
+		    memcmp(s->blob->str + names[id], name, len) == 0)
+			return id;
+
+	return id;
+}
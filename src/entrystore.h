@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _ENTRYSTORE_H
+#define _ENTRYSTORE_H
+
+#include <stdint.h>
+
+#include <glib.h>
+
+#include "entry.h"
+
+struct entry_store;
+
+struct entry_store	*entry_store_new(void);
+void			 entry_store_free(struct entry_store *);
+guint			 entry_store_add(struct entry_store *,
+    const struct entry *);
+void			 entry_store_replace(struct entry_store *, guint,
+    const struct entry *);
+guint			 entry_store_len(struct entry_store *);
+guint			 entry_store_changes(struct entry_store *);
+const struct entry	*entry_store_entry(struct entry_store *, guint);
+const char		*entry_store_exec(struct entry_store *, guint);
+uint8_t			 entry_store_fcodes(struct entry_store *, guint);
+int			 entry_store_term(struct entry_store *, guint);
+int			 entry_store_compare(struct entry_store *, guint,
+    guint);
+guint			 entry_store_find(struct entry_store *, const char *,
+    guint);
+
+#endif /* _ENTRYSTORE_H */
@@ -0,0 +1,686 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Resolve icon names to files by reading the icon-theme.cache files that
+ * gtk-update-icon-cache(1) writes into each theme directory. The caches are
+ * mmap(2)ed and searched by hash; no icon directory is ever listed.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+
+#include "icontheme.h"
+#include "compat.h"
+
+#define IC_NONE		0xffffffff	/* A missing offset in the cache */
+#define IC_HAS_XPM	(1 << 0)
+#define IC_HAS_SVG	(1 << 1)
+#define IC_HAS_PNG	(1 << 2)
+
+enum subdir_type {
+	SUBDIR_FIXED,
+	SUBDIR_SCALABLE,
+	SUBDIR_THRESHOLD,
+};
+
+/*
+ * One mmap(2)ed icon-theme.cache.
+ */
+struct icon_cache {
+	char		*map;
+	size_t		 len;
+	char		*dir;		/* The theme directory */
+	char		*path;		/* The cache file */
+	time_t		 mtime;		/* Of the cache file */
+};
+
+/*
+ * A directory of icons as described by index.theme.
+ */
+struct icon_subdir {
+	enum subdir_type	type;
+	int			size;
+	int			min_size;
+	int			max_size;
+	int			threshold;
+	int			scale;
+};
+
+struct icon_theme {
+	char		*name;
+	GPtrArray	*caches;	/* struct icon_cache */
+	GHashTable	*subdirs;	/* Name to struct icon_subdir */
+	int		 complete;	/* Every theme directory had a cache */
+};
+
+static GPtrArray	*chain = NULL;	/* The themes, in lookup order */
+static char		*chain_name = NULL;
+static gint64		 checked = 0;	/* When the caches were last checked */
+static guint		 generation = 0; /* Bumped on every load */
+
+static void		 icon_theme_load(void);
+static void		 icon_theme_unload(void);
+static void		 icon_theme_check(void);
+static char		*icon_theme_name(void);
+static void		 icon_theme_add(const char *, GHashTable *);
+static void		 icon_theme_free(struct icon_theme *);
+static GPtrArray	*icon_base_dirs(void);
+static void		 icon_subdirs_load(struct icon_theme *, GKeyFile *);
+static int		 icon_subdir_distance(const struct icon_subdir *, int,
+    int);
+static struct icon_cache *icon_cache_open(const char *);
+static void		 icon_cache_free(struct icon_cache *);
+static uint32_t		 ic_u16(const struct icon_cache *, uint32_t);
+static uint32_t		 ic_u32(const struct icon_cache *, uint32_t);
+static const char	*ic_string(const struct icon_cache *, uint32_t);
+static uint32_t		 ic_find(const struct icon_cache *, const char *);
+static char		*icon_unthemed(const char *);
+
+/*
+ * Find the file for the named icon closest to the given size and scale.
+ * Returns NULL if no theme has it.
+ */
+char *
+icon_theme_lookup(const char *name, int size, int scale)
+{
+	int			 dist, best_dist;
+	char			*best = NULL;
+	const char		*subdir;
+	const char		*ext;
+	uint32_t		 images, n, i, flags, dir_list;
+	guint			 t, j;
+	struct icon_theme	*theme;
+	struct icon_cache	*c;
+	struct icon_subdir	*sd;
+
+	icon_theme_check();
+
+	for (t = 0; t < chain->len; t++) {
+		theme = g_ptr_array_index(chain, t);
+		best_dist = INT_MAX;
+
+		for (j = 0; j < theme->caches->len; j++) {
+			c = g_ptr_array_index(theme->caches, j);
+			if ((images = ic_find(c, name)) == IC_NONE)
+				continue;
+
+			dir_list = ic_u32(c, 8);
+			n = ic_u32(c, images);
+			for (i = 0; i < n && n != IC_NONE; i++) {
+				subdir = ic_string(c, ic_u32(c, dir_list + 4 +
+				    4 * ic_u16(c, images + 4 + 8 * i)));
+				flags = ic_u16(c, images + 4 + 8 * i + 2);
+				if (subdir == NULL)
+					continue;
+				if ((sd = g_hash_table_lookup(theme->subdirs,
+				    subdir)) == NULL)
+					continue;
+
+				if (flags & IC_HAS_PNG)
+					ext = ".png";
+				else if (flags & IC_HAS_SVG)
+					ext = ".svg";
+				else if (flags & IC_HAS_XPM)
+					ext = ".xpm";
+				else
+					continue;
+
+				dist = icon_subdir_distance(sd, size, scale);
+				if (dist >= best_dist)
+					continue;
+
+				g_free(best);
+				best = g_strdup_printf("%s/%s/%s%s", c->dir,
+				    subdir, name, ext);
+				if ((best_dist = dist) == 0)
+					return best;
+			}
+		}
+
+		if (best)
+			return best;
+	}
+
+	return icon_unthemed(name);
+}
+
+/*
+ * Whether every theme in the chain is covered by a cache. If not, a failed
+ * lookup is not final.
+ */
+int
+icon_theme_is_complete(void)
+{
+	guint			 t;
+	struct icon_theme	*theme;
+
+	icon_theme_check();
+
+	for (t = 0; t < chain->len; t++) {
+		theme = g_ptr_array_index(chain, t);
+		if (!theme->complete)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * A number that changes whenever the theme chain is reloaded, so that
+ * callers can tell when results they kept from earlier lookups are stale.
+ */
+guint
+icon_theme_generation(void)
+{
+	icon_theme_check();
+
+	return generation;
+}
+
+/*
+ * Load the theme chain on first use, and reload it when the theme or any of
+ * its caches change. This is checked at most once a second.
+ */
+void
+icon_theme_check(void)
+{
+	char			*name;
+	gint64			 now;
+	guint			 t, j;
+	struct stat		 sb;
+	struct icon_theme	*theme;
+	struct icon_cache	*c;
+
+	now = g_get_monotonic_time();
+	if (chain && now - checked < G_TIME_SPAN_SECOND)
+		return;
+	checked = now;
+
+	if (chain == NULL) {
+		icon_theme_load();
+		return;
+	}
+
+	name = icon_theme_name();
+	if (strcmp(name, chain_name) != 0)
+		goto reload;
+
+	for (t = 0; t < chain->len; t++) {
+		theme = g_ptr_array_index(chain, t);
+		for (j = 0; j < theme->caches->len; j++) {
+			c = g_ptr_array_index(theme->caches, j);
+			if (stat(c->path, &sb) < 0 || sb.st_mtime != c->mtime)
+				goto reload;
+		}
+	}
+
+	g_free(name);
+	return;
+
+reload:
+	g_free(name);
+	icon_theme_unload();
+	icon_theme_load();
+}
+
+/*
+ * The name of the current icon theme.
+ */
+char *
+icon_theme_name(void)
+{
+	char		*name = NULL;
+	GtkSettings	*settings;
+
+	if ((settings = gtk_settings_get_default()) != NULL)
+		g_object_get(settings, "gtk-icon-theme-name", &name, NULL);
+
+	if (name == NULL || !*name) {
+		g_free(name);
+		name = g_strdup("hicolor");
+	}
+
+	return name;
+}
+
+/*
+ * Build the chain of themes: the current theme, everything it inherits from,
+ * and finally hicolor.
+ */
+void
+icon_theme_load(void)
+{
+	GHashTable	*seen;
+
+	chain = g_ptr_array_new();
+	chain_name = icon_theme_name();
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	icon_theme_add(chain_name, seen);
+	icon_theme_add("hicolor", seen);
+
+	g_hash_table_unref(seen);
+	generation++;
+}
+
+/*
+ * Free the theme chain.
+ */
+void
+icon_theme_unload(void)
+{
+	guint	t;
+
+	for (t = 0; t < chain->len; t++)
+		icon_theme_free(g_ptr_array_index(chain, t));
+	g_ptr_array_free(chain, TRUE);
+	chain = NULL;
+
+	g_free(chain_name);
+	chain_name = NULL;
+}
+
+/*
+ * Append the named theme and, depth first, the themes it inherits from.
+ */
+void
+icon_theme_add(const char *name, GHashTable *seen)
+{
+	char			*dir, *fn, **inherits = NULL, **p;
+	guint			 i;
+	struct stat		 sb;
+	GPtrArray		*bases;
+	GKeyFile		*index = NULL;
+	struct icon_theme	*theme;
+	struct icon_cache	*c;
+
+	if (!g_hash_table_add(seen, g_strdup(name)))
+		return;
+
+	if ((theme = calloc(1, sizeof(struct icon_theme))) == NULL)
+		err(1, NULL);
+	theme->name = g_strdup(name);
+	theme->caches = g_ptr_array_new();
+	theme->subdirs = g_hash_table_new_full(g_str_hash, g_str_equal,
+	    g_free, free);
+	theme->complete = 1;
+
+	bases = icon_base_dirs();
+	for (i = 0; i < bases->len; i++) {
+		dir = g_build_filename(g_ptr_array_index(bases, i), name,
+		    NULL);
+		if (stat(dir, &sb) < 0 || !S_ISDIR(sb.st_mode)) {
+			g_free(dir);
+			continue;
+		}
+
+		if (index == NULL) {
+			fn = g_build_filename(dir, "index.theme", NULL);
+			index = g_key_file_new();
+			if (!g_key_file_load_from_file(index, fn,
+			    G_KEY_FILE_NONE, NULL)) {
+				g_key_file_free(index);
+				index = NULL;
+			}
+			g_free(fn);
+		}
+
+		if ((c = icon_cache_open(dir)) != NULL)
+			g_ptr_array_add(theme->caches, c);
+		else
+			theme->complete = 0;
+		g_free(dir);
+	}
+	g_ptr_array_free(bases, TRUE);
+
+	if (index == NULL) {
+		/* Not a theme after all. */
+		icon_theme_free(theme);
+		return;
+	}
+
+	icon_subdirs_load(theme, index);
+	g_ptr_array_add(chain, theme);
+
+	inherits = g_key_file_get_string_list(index, "Icon Theme", "Inherits",
+	    NULL, NULL);
+	for (p = inherits; p && *p; p++)
+		icon_theme_add(*p, seen);
+
+	g_strfreev(inherits);
+	g_key_file_free(index);
+}
+
+/*
+ * Free one theme.
+ */
+void
+icon_theme_free(struct icon_theme *theme)
+{
+	guint	j;
+
+	for (j = 0; j < theme->caches->len; j++)
+		icon_cache_free(g_ptr_array_index(theme->caches, j));
+	g_ptr_array_free(theme->caches, TRUE);
+	g_hash_table_unref(theme->subdirs);
+	g_free(theme->name);
+	free(theme);
+}
+
+/*
+ * The directories that hold icon themes, in priority order.
+ */
+GPtrArray *
+icon_base_dirs(void)
+{
+	GPtrArray		*bases;
+	const gchar *const	*dirs;
+
+	bases = g_ptr_array_new_with_free_func(g_free);
+
+	g_ptr_array_add(bases, g_build_filename(g_get_home_dir(), ".icons",
+	    NULL));
+	g_ptr_array_add(bases, g_build_filename(g_get_user_data_dir(), "icons",
+	    NULL));
+	for (dirs = g_get_system_data_dirs(); *dirs; dirs++)
+		g_ptr_array_add(bases, g_build_filename(*dirs, "icons", NULL));
+
+	return bases;
+}
+
+/*
+ * Read the size of each icon directory in the theme.
+ */
+void
+icon_subdirs_load(struct icon_theme *theme, GKeyFile *index)
+{
+	char			**dirs, **p, *type;
+	struct icon_subdir	 *sd;
+
+	dirs = g_key_file_get_string_list(index, "Icon Theme", "Directories",
+	    NULL, NULL);
+
+	for (p = dirs; p && *p; p++) {
+		if ((sd = calloc(1, sizeof(struct icon_subdir))) == NULL)
+			err(1, NULL);
+
+		sd->size = g_key_file_get_integer(index, *p, "Size", NULL);
+		sd->min_size = sd->max_size = sd->size;
+		if (g_key_file_has_key(index, *p, "MinSize", NULL))
+			sd->min_size = g_key_file_get_integer(index, *p,
+			    "MinSize", NULL);
+		if (g_key_file_has_key(index, *p, "MaxSize", NULL))
+			sd->max_size = g_key_file_get_integer(index, *p,
+			    "MaxSize", NULL);
+		sd->threshold = 2;
+		if (g_key_file_has_key(index, *p, "Threshold", NULL))
+			sd->threshold = g_key_file_get_integer(index, *p,
+			    "Threshold", NULL);
+		sd->scale = 1;
+		if (g_key_file_has_key(index, *p, "Scale", NULL))
+			sd->scale = g_key_file_get_integer(index, *p, "Scale",
+			    NULL);
+
+		sd->type = SUBDIR_THRESHOLD;
+		if ((type = g_key_file_get_string(index, *p, "Type",
+		    NULL)) != NULL) {
+			if (strcmp(type, "Fixed") == 0)
+				sd->type = SUBDIR_FIXED;
+			else if (strcmp(type, "Scalable") == 0)
+				sd->type = SUBDIR_SCALABLE;
+			g_free(type);
+		}
+
+		g_hash_table_replace(theme->subdirs, g_strdup(*p), sd);
+	}
+
+	g_strfreev(dirs);
+}
+
+/*
+ * How far the icons in a directory are from the wanted size, as described in
+ * the Icon Theme Specification. Zero is an exact match.
+ */
+int
+icon_subdir_distance(const struct icon_subdir *sd, int size, int scale)
+{
+	int	want, lo, hi;
+
+	want = size * scale;
+
+	switch (sd->type) {
+	case SUBDIR_FIXED:
+		lo = hi = sd->size * sd->scale;
+		break;
+	case SUBDIR_SCALABLE:
+		lo = sd->min_size * sd->scale;
+		hi = sd->max_size * sd->scale;
+		break;
+	case SUBDIR_THRESHOLD:
+	default:
+		lo = (sd->size - sd->threshold) * sd->scale;
+		hi = (sd->size + sd->threshold) * sd->scale;
+		break;
+	}
+
+	if (sd->scale == scale && want >= lo && want <= hi)
+		return 0;
+	if (want < lo)
+		return lo - want + 1;
+	if (want > hi)
+		return want - hi + 1;
+	return 1;
+}
+
+/*
+ * Map the icon-theme.cache in a theme directory. The cache is ignored if the
+ * directory has changed since the cache was written, as GTK does.
+ */
+struct icon_cache *
+icon_cache_open(const char *dir)
+{
+	int			 fd;
+	char			*path, *map;
+	struct stat		 sb, dsb;
+	struct icon_cache	*c = NULL;
+
+	path = g_build_filename(dir, "icon-theme.cache", NULL);
+
+	if (stat(dir, &dsb) < 0 || (fd = open(path, O_RDONLY)) < 0) {
+		g_free(path);
+		return NULL;
+	}
+
+	if (fstat(fd, &sb) < 0 || sb.st_size < 12 ||
+	    sb.st_mtime < dsb.st_mtime)
+		goto done;
+
+	map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		goto done;
+
+	if ((c = calloc(1, sizeof(struct icon_cache))) == NULL)
+		err(1, NULL);
+	c->map = map;
+	c->len = sb.st_size;
+	c->dir = g_strdup(dir);
+	c->path = path;
+	c->mtime = sb.st_mtime;
+	path = NULL;
+
+	if (ic_u16(c, 0) != 1) {
+		icon_cache_free(c);
+		c = NULL;
+	}
+
+done:
+	close(fd);
+	g_free(path);
+	return c;
+}
+
+/*
+ * Unmap and free a cache.
+ */
+void
+icon_cache_free(struct icon_cache *c)
+{
+	munmap(c->map, c->len);
+	g_free(c->dir);
+	g_free(c->path);
+	free(c);
+}
+
+/*
+ * Read big-endian integers from the cache. Reads past the end yield IC_NONE,
+ * which ends any walk through the cache.
+ */
+uint32_t
+ic_u16(const struct icon_cache *c, uint32_t off)
+{
+	const unsigned char	*p;
+
+	if ((size_t)off + 2 > c->len)
+		return IC_NONE;
+
+	p = (const unsigned char *)c->map + off;
+	return (uint32_t)p[0] << 8 | p[1];
+}
+
+uint32_t
+ic_u32(const struct icon_cache *c, uint32_t off)
+{
+	const unsigned char	*p;
+
+	if ((size_t)off + 4 > c->len)
+		return IC_NONE;
+
+	p = (const unsigned char *)c->map + off;
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3];
+}
+
+/*
+ * The NUL-terminated string at the offset, or NULL.
+ */
+const char *
+ic_string(const struct icon_cache *c, uint32_t off)
+{
+	if (off >= c->len || memchr(c->map + off, '\0', c->len - off) == NULL)
+		return NULL;
+
+	return c->map + off;
+}
+
+/*
+ * Find an icon by name in the cache's hash table. Returns the offset of its
+ * image list.
+ */
+uint32_t
+ic_find(const struct icon_cache *c, const char *name)
+{
+	const signed char	*p;
+	const char		*s;
+	uint32_t		 h, hash, buckets, off;
+	size_t			 limit;
+
+	/* The same hash as gtk-update-icon-cache(1). */
+	p = (const signed char *)name;
+	if ((h = *p) != 0)
+		for (p++; *p; p++)
+			h = (h << 5) - h + *p;
+
+	hash = ic_u32(c, 4);
+	if ((buckets = ic_u32(c, hash)) == 0 || buckets == IC_NONE)
+		return IC_NONE;
+
+	off = ic_u32(c, hash + 4 + 4 * (h % buckets));
+	for (limit = c->len / 12; off != IC_NONE && limit > 0; limit--) {
+		s = ic_string(c, ic_u32(c, off + 4));
+		if (s && strcmp(s, name) == 0)
+			return ic_u32(c, off + 8);
+		off = ic_u32(c, off);
+	}
+
+	return IC_NONE;
+}
+
+/*
+ * Icons outside of any theme, at the top of the directories GTK searches:
+ * the icons directories of $XDG_DATA_HOME, ~/.icons, and each of
+ * $XDG_DATA_DIRS, and then the pixmaps directories of $XDG_DATA_DIRS. A name
+ * may already end in its extension.
+ */
+char *
+icon_unthemed(const char *name)
+{
+	char			*fn;
+	const char		*exts[] = { "", ".png", ".svg", ".xpm" };
+	size_t			 i, j;
+	struct stat		 sb;
+	GPtrArray		*dirs;
+	const gchar *const	*data_dirs;
+
+	dirs = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(dirs, g_build_filename(g_get_user_data_dir(), "icons",
+	    NULL));
+	g_ptr_array_add(dirs, g_build_filename(g_get_home_dir(), ".icons",
+	    NULL));
+	for (data_dirs = g_get_system_data_dirs(); *data_dirs; data_dirs++)
+		g_ptr_array_add(dirs, g_build_filename(*data_dirs, "icons",
+		    NULL));
+	for (data_dirs = g_get_system_data_dirs(); *data_dirs; data_dirs++)
+		g_ptr_array_add(dirs, g_build_filename(*data_dirs, "pixmaps",
+		    NULL));
+
+	for (i = 0; i < dirs->len; i++)
+		for (j = 0; j < sizeof(exts) / sizeof(exts[0]); j++) {
+			/* Only a name with an extension is taken as is. */
+			if (*exts[j] == '\0' && strchr(name, '.') == NULL)
+				continue;
+
+			fn = g_strdup_printf("%s/%s%s",
+			    (char *)g_ptr_array_index(dirs, i), name, exts[j]);
+			if (stat(fn, &sb) == 0 && S_ISREG(sb.st_mode)) {
+				g_ptr_array_free(dirs, TRUE);
+				return fn;
+			}
+			g_free(fn);
+		}
+
+	g_ptr_array_free(dirs, TRUE);
+	return NULL;
+}
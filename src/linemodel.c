@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A flat, single-column GtkTreeModel over lines of text, for choosing among
+ * far more rows than a GtkListStore handles comfortably. Lines are only ever
+ * appended, into one string chunk, and the model shows those that contain the
+ * filter, compared case-folded. A filter that extends the previous one only
+ * looks at the lines already shown.
+ *
+ * Rows are not signalled when the filter changes, since a view would then
+ * handle them one at a time; detach the model from its views while setting
+ * the filter.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+
+#include "linemodel.h"
+#include "compat.h"
+
+struct _BsLineModelPrivate {
+	GStringChunk	*text;		/* The lines, and their folded forms */
+	GPtrArray	*lines;		/* Each line, as read */
+	GPtrArray	*folded;	/* Each line, case-folded */
+	GArray		*shown;		/* Indices of the lines that match */
+	char		*filter;	/* The folded filter, or NULL */
+	gint		 stamp;		/* Changes when the filter does */
+};
+
+static void		 bs_line_model_class_init(BsLineModelClass *);
+static void		 bs_line_model_init(BsLineModel *);
+static void		 bs_line_model_tree_model_init(GtkTreeModelIface *);
+static void		 bs_line_model_finalize(GObject *);
+static GtkTreeModelFlags bs_line_model_get_flags(GtkTreeModel *);
+static gint		 bs_line_model_get_n_columns(GtkTreeModel *);
+static GType		 bs_line_model_get_column_type(GtkTreeModel *, gint);
+static gboolean		 bs_line_model_get_iter(GtkTreeModel *, GtkTreeIter *,
+    GtkTreePath *);
+static GtkTreePath	*bs_line_model_get_path(GtkTreeModel *, GtkTreeIter *);
+static void		 bs_line_model_get_value(GtkTreeModel *, GtkTreeIter *,
+    gint, GValue *);
+static gboolean		 bs_line_model_iter_next(GtkTreeModel *, GtkTreeIter *);
+static gboolean		 bs_line_model_iter_children(GtkTreeModel *,
+    GtkTreeIter *, GtkTreeIter *);
+static gboolean		 bs_line_model_iter_has_child(GtkTreeModel *,
+    GtkTreeIter *);
+static gint		 bs_line_model_iter_n_children(GtkTreeModel *,
+    GtkTreeIter *);
+static gboolean		 bs_line_model_iter_nth_child(GtkTreeModel *,
+    GtkTreeIter *, GtkTreeIter *, gint);
+static gboolean		 bs_line_model_iter_parent(GtkTreeModel *,
+    GtkTreeIter *, GtkTreeIter *);
+static int		 bs_line_model_matches(BsLineModel *, guint);
+
+G_DEFINE_TYPE_WITH_CODE(BsLineModel, bs_line_model, G_TYPE_OBJECT,
+    G_ADD_PRIVATE(BsLineModel)
+    G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, bs_line_model_tree_model_init))
+
+static void
+bs_line_model_class_init(BsLineModelClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = bs_line_model_finalize;
+}
+
+static void
+bs_line_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = bs_line_model_get_flags;
+	iface->get_n_columns = bs_line_model_get_n_columns;
+	iface->get_column_type = bs_line_model_get_column_type;
+	iface->get_iter = bs_line_model_get_iter;
+	iface->get_path = bs_line_model_get_path;
+	iface->get_value = bs_line_model_get_value;
+	iface->iter_next = bs_line_model_iter_next;
+	iface->iter_children = bs_line_model_iter_children;
+	iface->iter_has_child = bs_line_model_iter_has_child;
+	iface->iter_n_children = bs_line_model_iter_n_children;
+	iface->iter_nth_child = bs_line_model_iter_nth_child;
+	iface->iter_parent = bs_line_model_iter_parent;
+}
+
+static void
+bs_line_model_init(BsLineModel *model)
+{
+	model->priv = bs_line_model_get_instance_private(model);
+	model->priv->text = g_string_chunk_new(1 << 16);
+	model->priv->lines = g_ptr_array_new();
+	model->priv->folded = g_ptr_array_new();
+	model->priv->shown = g_array_new(FALSE, FALSE, sizeof(guint));
+	model->priv->filter = NULL;
+	model->priv->stamp = g_random_int();
+}
+
+static void
+bs_line_model_finalize(GObject *object)
+{
+	BsLineModelPrivate	*priv;
+
+	priv = BS_LINE_MODEL(object)->priv;
+	g_string_chunk_free(priv->text);
+	g_ptr_array_free(priv->lines, TRUE);
+	g_ptr_array_free(priv->folded, TRUE);
+	g_array_free(priv->shown, TRUE);
+	g_free(priv->filter);
+
+	G_OBJECT_CLASS(bs_line_model_parent_class)->finalize(object);
+}
+
+BsLineModel *
+bs_line_model_new(void)
+{
+	return g_object_new(BS_TYPE_LINE_MODEL, NULL);
+}
+
+/*
+ * Add a line, which need not be NUL-terminated, after all the others. It is
+ * shown, and signalled, if it matches the filter.
+ */
+void
+bs_line_model_append(BsLineModel *model, const char *line, gsize len)
+{
+	char			*s, *valid, *folded;
+	guint			 idx;
+	GtkTreeIter		 iter;
+	GtkTreePath		*path;
+	BsLineModelPrivate	*priv;
+
+	priv = model->priv;
+
+	s = g_string_chunk_insert_len(priv->text, line, len);
+	valid = g_utf8_validate(s, len, NULL) ? NULL : g_utf8_make_valid(s, len);
+	folded = g_utf8_casefold(valid ? valid : s, -1);
+
+	idx = priv->lines->len;
+	g_ptr_array_add(priv->lines, s);
+	g_ptr_array_add(priv->folded, strcmp(folded, s) == 0 ? s :
+	    g_string_chunk_insert(priv->text, folded));
+
+	g_free(folded);
+	g_free(valid);
+
+	if (!bs_line_model_matches(model, idx))
+		return;
+
+	g_array_append_val(priv->shown, idx);
+
+	iter.stamp = priv->stamp;
+	iter.user_data = GUINT_TO_POINTER(priv->shown->len - 1);
+	path = gtk_tree_path_new_from_indices(priv->shown->len - 1, -1);
+	gtk_tree_model_row_inserted(GTK_TREE_MODEL(model), path, &iter);
+	gtk_tree_path_free(path);
+}
+
+/*
+ * Show only the lines containing the text, ignoring case. Outstanding
+ * iterators become invalid. An empty or NULL filter shows every line.
+ */
+void
+bs_line_model_set_filter(BsLineModel *model, const char *filter)
+{
+	char			*folded = NULL;
+	guint			 i, n = 0, idx;
+	GArray			*from = NULL;
+	BsLineModelPrivate	*priv;
+
+	priv = model->priv;
+
+	if (filter && *filter)
+		folded = g_utf8_casefold(filter, -1);
+
+	/* Narrowing the filter can only hide lines. */
+	if (folded && priv->filter && strstr(folded, priv->filter))
+		from = priv->shown;
+
+	g_free(priv->filter);
+	priv->filter = folded;
+	priv->stamp++;
+
+	if (from) {
+		for (i = 0; i < from->len; i++) {
+			idx = g_array_index(from, guint, i);
+			if (bs_line_model_matches(model, idx))
+				g_array_index(priv->shown, guint, n++) = idx;
+		}
+		g_array_set_size(priv->shown, n);
+		return;
+	}
+
+	g_array_set_size(priv->shown, 0);
+	for (idx = 0; idx < priv->lines->len; idx++)
+		if (bs_line_model_matches(model, idx))
+			g_array_append_val(priv->shown, idx);
+}
+
+/*
+ * The line at the iterator, exactly as it was appended.
+ */
+const char *
+bs_line_model_get_line(BsLineModel *model, GtkTreeIter *iter)
+{
+	guint	pos;
+
+	pos = GPOINTER_TO_UINT(iter->user_data);
+	return g_ptr_array_index(model->priv->lines,
+	    g_array_index(model->priv->shown, guint, pos));
+}
+
+/*
+ * The number of lines appended, shown or not.
+ */
+guint
+bs_line_model_get_length(BsLineModel *model)
+{
+	return model->priv->lines->len;
+}
+
+/*
+ * Whether the line contains the filter.
+ */
+int
+bs_line_model_matches(BsLineModel *model, guint idx)
+{
+	if (model->priv->filter == NULL)
+		return 1;
+
+	return strstr(g_ptr_array_index(model->priv->folded, idx),
+	    model->priv->filter) != NULL;
+}
+
+static GtkTreeModelFlags
+bs_line_model_get_flags(GtkTreeModel *tree_model)
+{
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+bs_line_model_get_n_columns(GtkTreeModel *tree_model)
+{
+	return 1;
+}
+
+static GType
+bs_line_model_get_column_type(GtkTreeModel *tree_model, gint column)
+{
+	return G_TYPE_STRING;
+}
+
+static gboolean
+bs_line_model_get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter,
+    GtkTreePath *path)
+{
+	return bs_line_model_iter_nth_child(tree_model, iter, NULL,
+	    gtk_tree_path_get_indices(path)[0]);
+}
+
+static GtkTreePath *
+bs_line_model_get_path(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return gtk_tree_path_new_from_indices(
+	    GPOINTER_TO_UINT(iter->user_data), -1);
+}
+
+static void
+bs_line_model_get_value(GtkTreeModel *tree_model, GtkTreeIter *iter,
+    gint column, GValue *value)
+{
+	const char	*line;
+
+	line = bs_line_model_get_line(BS_LINE_MODEL(tree_model), iter);
+
+	g_value_init(value, G_TYPE_STRING);
+	if (g_utf8_validate(line, -1, NULL))
+		g_value_set_static_string(value, line);
+	else
+		g_value_take_string(value, g_utf8_make_valid(line, -1));
+}
+
+static gboolean
+bs_line_model_iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	guint	pos;
+
+	pos = GPOINTER_TO_UINT(iter->user_data) + 1;
+	if (pos >= BS_LINE_MODEL(tree_model)->priv->shown->len) {
+		iter->stamp = 0;
+		return FALSE;
+	}
+
+	iter->user_data = GUINT_TO_POINTER(pos);
+	return TRUE;
+}
+
+static gboolean
+bs_line_model_iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter,
+    GtkTreeIter *parent)
+{
+	return bs_line_model_iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gboolean
+bs_line_model_iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return FALSE;
+}
+
+static gint
+bs_line_model_iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	if (iter)
+		return 0;
+
+	return BS_LINE_MODEL(tree_model)->priv->shown->len;
+}
+
+static gboolean
+bs_line_model_iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter,
+    GtkTreeIter *parent, gint n)
+{
+	BsLineModelPrivate	*priv;
+
+	priv = BS_LINE_MODEL(tree_model)->priv;
+
+	if (parent || n < 0 || (guint)n >= priv->shown->len) {
+		iter->stamp = 0;
+		return FALSE;
+	}
+
+	iter->stamp = priv->stamp;
+	iter->user_data = GUINT_TO_POINTER(n);
+	return TRUE;
+}
+
+static gboolean
+bs_line_model_iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter,
+    GtkTreeIter *child)
+{
+	iter->stamp = 0;
+	return FALSE;
+}
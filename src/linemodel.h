@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _LINEMODEL_H
+#define _LINEMODEL_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define BS_TYPE_LINE_MODEL bs_line_model_get_type()
+#define BS_LINE_MODEL(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), BS_TYPE_LINE_MODEL, BsLineModel))
+
+typedef struct _BsLineModel        BsLineModel;
+typedef struct _BsLineModelClass   BsLineModelClass;
+typedef struct _BsLineModelPrivate BsLineModelPrivate;
+
+struct _BsLineModel {
+	GObject			 parent;
+	BsLineModelPrivate	*priv;
+};
+
+struct _BsLineModelClass {
+	GObjectClass	parent_class;
+};
+
+GType		 bs_line_model_get_type(void);
+BsLineModel	*bs_line_model_new(void);
+void		 bs_line_model_append(BsLineModel *, const char *, gsize);
+void		 bs_line_model_set_filter(BsLineModel *, const char *);
+const char	*bs_line_model_get_line(BsLineModel *, GtkTreeIter *);
+guint		 bs_line_model_get_length(BsLineModel *);
+
+G_END_DECLS
+
+#endif /* _LINEMODEL_H */
@@ -22,7 +22,10 @@
 
 #include <sys/wait.h>
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
+#include <locale.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -31,7 +34,22 @@
 
 #include <gtk/gtk.h>
 
+#include "atlas.h"
+#include "bench.h"
+#include "chooser.h"
+#include "completion.h"
+#include "dbusapp.h"
+#include "desktop.h"
 #include "entrycellrenderer.h"
+#include "entrystore.h"
+#include "metrics.h"
+#include "mimeindex.h"
+#include "pathindex.h"
+#include "prefetch.h"
+#include "readahead.h"
+#include "scan.h"
+#include "search.h"
+#include "startup.h"
 #include "compat.h"
 
 enum {
@@ -40,23 +58,70 @@ enum {
 	FCODE_COLUMN,
 	ICON_COLUMN,
 	TERM_COLUMN,
+	COLLATE_COLUMN,
+	ID_COLUMN,
+	FILE_COLUMN,
+	DBUS_COLUMN,
+	NOTIFY_COLUMN,
+	ENTRY_COLUMN,
 	NUM_COLUMNS,
 };
 
-enum field_code {
-	NO_PLACEHOLDER = 1 << 0,
-	SINGLE_FILE_PLACEHOLDER = 1 << 1,
-	MULTI_FILE_PLACEHOLDER = 1 << 2,
-	SINGLE_URL_PLACEHOLDER = 1 << 3,
-	MULTI_URL_PLACEHOLDER = 1 << 4,
+/*
+ * The entry store ID of action rows and of the placeholder row that stands in
+ * for the actions until they are loaded.
+ */
+#define ACTION_ID	G_MAXUINT
+
+/*
+ * How long to wait for each applications directory before falling back to its
+ * cache. The directories are read in parallel, so they share one deadline.
+ */
+#define SCAN_BUDGET	(500 * G_TIME_SPAN_MILLISECOND)
+
+/*
+ * The directory that a desktop file ID was first seen in, and its row, if it
+ * is shown. Rows of a tree store stay valid until they are removed.
+ */
+struct claim {
+	guint		prio;		/* The index of the directory */
+	gboolean	shown;		/* Whether it has a row */
+	GtkTreeIter	iter;
 };
 
 struct state {
 	char		*cmd;		/* The command to run */
 	char		*name;		/* The program name to run, if any */
+	char		*app_id;	/* The desktop ID, if DBusActivatable */
+	char		*label;		/* The entry name, for startup notification */
+	char		*wmclass;	/* StartupWMClass, if any */
+	char		*id;		/* The desktop file ID, for the metrics */
+	gboolean	 notify;	/* StartupNotify */
 	uint8_t		 shift_pressed;	/* Whether shift is being held */
 	uint8_t		 flags;		/* Command flags as set by the desktop entry */
 	gboolean	 use_term;	/* Whether to run the command in a terminal */
+	gchar		**drop_uris;	/* Files dropped on the entry, if any */
+};
+
+/*
+ * A launch waiting on D-Bus activation, with the command to run should it
+ * fail.
+ */
+struct launch {
+	char		*cmd;		/* The command line, as filled in */
+	char		*startup_id;	/* DESKTOP_STARTUP_ID, or NULL */
+	char		*id;		/* The desktop file ID, for the metrics */
+};
+
+/*
+ * A drag over the list. The dragged URIs are fetched on the first motion, and
+ * the entries that can open all of them are then found in the MIME index.
+ */
+struct drop {
+	gchar		**uris;		/* The dragged URIs, once received */
+	GHashTable	*targets;	/* Desktop file names that open them */
+	gboolean	  requested;	/* Whether the URIs are on their way */
+	gboolean	  dropped;	/* Whether the URIs are for the drop */
 };
 
 __dead void		 usage();
@@ -64,26 +129,82 @@ static struct state	*init_state(void);
 static void		 free_state(struct state *);
 static void		 run_app(struct state *);
 static uint8_t		 run_cmd(struct state *);
-static void		 exec_cmd(const char *);
-static GtkListStore	*collect_apps();
-static uint8_t	 	 field_codes(char *);
-static uint8_t		 fill_in_flags(char **, uint8_t);
+static int		 exec_cmd(const char *, const char *);
+static void		 launch_activated(int, gpointer);
+static GtkTreeStore	*collect_apps(gboolean);
+static GtkTreeStore	*apps_store_new(void);
+static GtkTreeStore	*bench_apps(int);
+static int		 parse_count(const char *);
+static char		*prompt_args(uint8_t);
+static gchar		**args_to_uris(const char *);
+static char		*desktop_id(GtkTreeModel *, GtkTreeIter *);
+static void		 set_launch_info(struct state *, GtkTreeModel *,
+    GtkTreeIter *);
+static char		*uris_to_args(gchar **, uint8_t);
+static gboolean		 drag_motion(GtkWidget *, GdkDragContext *, gint, gint,
+    guint, gpointer);
+static void		 drag_leave(GtkWidget *, GdkDragContext *, guint,
+    gpointer);
+static gboolean		 drag_drop(GtkWidget *, GdkDragContext *, gint, gint,
+    guint, gpointer);
+static void		 drag_data_received(GtkWidget *, GdkDragContext *, gint,
+    gint, GtkSelectionData *, guint, guint, gpointer);
+static GtkTreePath	*drop_target_at(GtkTreeView *, gint, gint);
+static GHashTable	*drop_targets_new(struct mime_index *, gchar **);
+static void		 drop_reset(void);
+static void		 drop_cell_data(GtkTreeViewColumn *, GtkCellRenderer *,
+    GtkTreeModel *, GtkTreeIter *, gpointer);
 static uint8_t		 add_terminal(char **);
 static char		*fill_in_command(const char *, const char *, uint8_t);
 static const char	*placeholder_from_flags(uint8_t);
 static void		 handle_response(GtkDialog *, gint, gpointer);
 static GtkWidget	*apps_tree_new();
-static void		 apps_list_insert_files(GtkListStore *, GHashTable *,
-    char *, DIR *, size_t);
+static GtkWidget	*apps_view_new(GtkTreeStore *);
+static void		 apps_wait(GtkWidget *);
+static GtkWidget	*stress_open(gpointer);
+static void		 apps_list_insert_entry(GtkTreeStore *, guint,
+    const struct entry *);
+static void		 apps_list_update_entry(GtkTreeStore *, struct claim *,
+    const struct entry *);
+static void		 apps_list_remove(GtkTreeStore *, struct claim *);
+static guint		 apps_order_bound(GArray *, struct entry_store *, guint,
+    int);
+static guint		 apps_order_find(GArray *, struct entry_store *, guint);
+static gboolean		 apps_entry_shows(const struct entry *);
+static gboolean		 expand_actions(GtkTreeView *, GtkTreeIter *,
+    GtkTreePath *, gpointer);
+static gboolean		 entry_tooltip(GtkWidget *, gint, gint, gboolean,
+    GtkTooltip *, gpointer);
+static void		 apps_tree_insert_actions(GtkTreeStore *, GtkTreeIter *,
+    const char *, const char *, gboolean);
 static void		 app_selected(GtkTreeView *, GtkTreePath *,
     GtkTreeViewColumn *, gpointer);
 static gboolean		 key_pressed(GtkWidget *, GdkEvent *, gpointer);
-static gboolean		 run_desktop_entry(GtkTreeModel *, GtkTreePath *,
+static void		 cursor_changed(GtkTreeView *, gpointer);
+static gboolean		 first_draw(GtkWidget *, cairo_t *, gpointer);
+static gboolean		 run_desktop_entry(GtkTreeStore *, guint,
+    struct state *);
+static gboolean		 search_equal(GtkTreeModel *, gint, const gchar *,
     GtkTreeIter *, gpointer);
-static void		 collect_apps_in_dir(GtkListStore *, GHashTable *,
-    const char *);
+static char		**apps_dirs(void);
+static void		 apps_merge_dir(GtkTreeStore *, struct scan *, guint);
+static void		 apps_merge_stale(GtkTreeStore *, struct scan *, guint);
+static void		 apps_merge_late(struct scan *, guint, gpointer);
+static void		 apps_dir_metrics(struct scan *, guint);
 
 static GtkWidget	*window = NULL;
+static struct drop	 drop = { NULL, NULL, FALSE, FALSE };
+static const char	*stub_exec = NULL;	/* Run instead of any command */
+
+static const struct option longopts[] = {
+	{ "bench-render",	required_argument,	NULL,	'R' },
+	{ "bench-startup",	required_argument,	NULL,	'B' },
+	{ "bench-stress",	required_argument,	NULL,	'L' },
+	{ "launch-stats",	no_argument,		NULL,	'S' },
+	{ "readahead",		no_argument,		NULL,	'r' },
+	{ "stdin",		no_argument,		NULL,	'i' },
+	{ NULL,			0,			NULL,	0 },
+};
 
 /*
  * A program runner.
@@ -91,27 +212,91 @@ static GtkWidget	*window = NULL;
 int
 main(int argc, char *argv[])
 {
-	int		 ch;
+	int		 ch, bench_rows = 0, bench_runs = 0, bench_cycles = 0;
+	int		 from_stdin = 0;
+	int		 warm = 0, paint_fd;
+	char		*self;
 	GtkWidget	*box, *label, *apps_tree, *scrollable;
 	GValue		 g_9 = G_VALUE_INIT;
 	GtkBindingSet	*binding_set;
 	struct state	*st;
 
+	metrics_start();
+	setlocale(LC_ALL, "");
+
 	st = init_state();
+	self = argv[0];
 
-	while ((ch = getopt(argc, argv, "")) != -1)
-		usage();
+	while ((ch = getopt_long(argc, argv, "", longopts, NULL)) != -1)
+		switch (ch) {
+		case 'R':
+			bench_rows = parse_count(optarg);
+			break;
+		case 'B':
+			bench_runs = parse_count(optarg);
+			break;
+		case 'L':
+			bench_cycles = parse_count(optarg);
+			break;
+		case 'S':
+			return startup_stats();
+		case 'i':
+			from_stdin = 1;
+			break;
+		case 'r':
+			warm = 1;
+			break;
+		default:
+			usage();
+		}
 	argc -= optind;
 	argv += optind;
 
+	if (bench_runs) {
+		if (argc > 0)
+			usage();
+		return bench_startup(self, bench_runs);
+	}
+
+	/* Read the desktop entries while GTK initializes. */
+	if (!from_stdin)
+		prefetch_start();
+
 	gtk_init(&argc, &argv);
 
-	if (argc > 1)
+	if (argc > 1 || (from_stdin && argc > 0))
 		usage();
 
+	if (from_stdin)
+		return chooser_run();
+
+	if (bench_rows)
+		return bench_render(apps_view_new(bench_apps(bench_rows)));
+
+	/* Launch without prompting, and only ever true(1). */
+	if (bench_cycles) {
+		st->shift_pressed = 1;
+		stub_exec = "true";
+		return bench_stress(bench_cycles, stress_open, st);
+	}
+
+	/* A run of --bench-startup: stop at the first paint. */
+	if ((paint_fd = bench_paint_fd()) != -1) {
+		if ((apps_tree = apps_tree_new()) == NULL)
+			return 1;
+		bench_paint(apps_tree, paint_fd);
+		apps_wait(apps_tree);
+		atlas_save_all();
+		return 0;
+	}
+
 	if (argc == 1) {
 		st->name = strdup(argv[0]);
 		run_app(st);
+		dbus_app_wait();
+		startup_detach();
+		metrics_write();
+		free_state(st);
 		return 0;
 	}
 
@@ -141,9 +326,23 @@ main(int argc, char *argv[])
 	    /* fill */ 1, /* padding */ 3);
 
 	g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
+	g_signal_connect(window, "destroy", G_CALLBACK(gtk_widget_destroyed),
+	    &window);
 	g_signal_connect(window, "response", G_CALLBACK(handle_response), apps_tree);
 	g_signal_connect(window, "key-press-event", G_CALLBACK(key_pressed), st);
 	g_signal_connect(apps_tree, "row-activated", G_CALLBACK(app_selected), st);
+	g_signal_connect(apps_tree, "draw", G_CALLBACK(first_draw), NULL);
+	if (warm)
+		g_signal_connect(apps_tree, "cursor-changed",
+		    G_CALLBACK(cursor_changed), NULL);
+
+	gtk_drag_dest_set(apps_tree, 0, NULL, 0, GDK_ACTION_COPY);
+	gtk_drag_dest_add_uri_targets(apps_tree);
+	g_signal_connect(apps_tree, "drag-motion", G_CALLBACK(drag_motion), st);
+	g_signal_connect(apps_tree, "drag-leave", G_CALLBACK(drag_leave), st);
+	g_signal_connect(apps_tree, "drag-drop", G_CALLBACK(drag_drop), st);
+	g_signal_connect(apps_tree, "drag-data-received",
+	    G_CALLBACK(drag_data_received), st);
 
 	binding_set = gtk_binding_set_by_class(G_OBJECT_GET_CLASS(apps_tree));
 	gtk_binding_entry_add_signal(
@@ -155,11 +354,25 @@ main(int argc, char *argv[])
 	gtk_binding_entry_add_signal(
 	    binding_set, GDK_KEY_KP_Enter, GDK_SHIFT_MASK, "select-cursor-row",
 	    1, G_TYPE_BOOLEAN, TRUE);
+	gtk_binding_entry_add_signal(
+	    binding_set, GDK_KEY_Right, 0, "expand-collapse-cursor-row",
+	    3, G_TYPE_BOOLEAN, TRUE, G_TYPE_BOOLEAN, TRUE,
+	    G_TYPE_BOOLEAN, FALSE);
+	gtk_binding_entry_add_signal(
+	    binding_set, GDK_KEY_Left, 0, "expand-collapse-cursor-row",
+	    3, G_TYPE_BOOLEAN, TRUE, G_TYPE_BOOLEAN, FALSE,
+	    G_TYPE_BOOLEAN, FALSE);
 
 	gtk_widget_show_all(window);
 
 	gtk_main();
 
+	if (window)
+		gtk_widget_hide(window);
+	atlas_save_all();
+	dbus_app_wait();
+	startup_detach();
+	metrics_write();
 	free_state(st);
 	return 0;
 }
@@ -171,9 +384,31 @@ __dead void
 usage()
 {
 	printf("usage: bytestream [entry name]\n");
+	printf("       bytestream --bench-render=rows\n");
+	printf("       bytestream --bench-startup=runs\n");
+	printf("       bytestream --bench-stress=cycles\n");
+	printf("       bytestream --launch-stats\n");
+	printf("       bytestream --readahead [entry name]\n");
+	printf("       bytestream --stdin\n");
 	exit(0);
 }
 
+/*
+ * Parse a positive count from the command line, or show the usage.
+ */
+int
+parse_count(const char *arg)
+{
+	long	 n;
+	char	*end;
+
+	n = strtol(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || n <= 0 || n > INT32_MAX)
+		usage();
+
+	return n;
+}
+
 /*
  * Initialize an empty state structure. This structure is used to communicate
  * in callbacks.
@@ -188,6 +423,12 @@ init_state(void)
 
 	st->cmd = NULL;
 	st->name = NULL;
+	st->app_id = NULL;
+	st->label = NULL;
+	st->wmclass = NULL;
+	st->id = NULL;
+	st->notify = FALSE;
+	st->drop_uris = NULL;
 	st->shift_pressed = 0;
 	st->flags = 0;
 	st->use_term = 0;
@@ -204,76 +445,71 @@ free_state(struct state *st)
 	if (st) {
 		free(st->cmd);
 		free(st->name);
+		g_free(st->app_id);
+		g_free(st->label);
+		g_free(st->wmclass);
+		g_free(st->id);
+		g_strfreev(st->drop_uris);
 		free(st);
 	}
 }
 
 /*
- * Run a specific application by name.
+ * Run a specific application by name. The names are compared straight from
+ * the entry store rather than row by row through the model.
  */
 static void
 run_app(struct state *st)
 {
-	GtkListStore	*apps;
+	guint			 id;
+	GtkTreeStore		*apps;
+	struct entry_store	*store;
+
+	apps = collect_apps(FALSE);
+	if (apps == NULL)
+		return;
 
-	apps = collect_apps();
-	if (apps != NULL)
-		gtk_tree_model_foreach(
-		    GTK_TREE_MODEL(apps), run_desktop_entry, st);
+	store = g_object_get_data(G_OBJECT(apps), "entries");
+	for (id = 0; (id = entry_store_find(store, st->name, id)) <
+	    entry_store_len(store); id++)
+		if (run_desktop_entry(apps, id, st))
+			break;
+
+	g_object_unref(apps);
 }
 
 /*
- * If the given row in the model is the name we're looking for, run it.
- * Otherwise keep looking.
+ * If the row with the given name is still shown, run it. Rows that were
+ * replaced by another entry with the same ID are skipped.
  */
 gboolean
-run_desktop_entry(GtkTreeModel *model, GtkTreePath *path, GtkTreeIter *iter,
-    gpointer data)
+run_desktop_entry(GtkTreeStore *apps, guint id, struct state *st)
 {
-	char		*name_v;
-	struct state	*st;
-	GValue	 	 value = G_VALUE_INIT;
+	struct claim		*claim;
+	struct entry_store	*store;
+	const struct entry	*e, *shown;
 
-	st = (struct state *)data;
+	store = g_object_get_data(G_OBJECT(apps), "entries");
+	e = entry_store_entry(store, id);
 
-	gtk_tree_model_get_value(model, iter, NAME_COLUMN, &value);
-	if (!G_VALUE_HOLDS_STRING(&value)) {
-		warnx("gtk_tree_model_get_value: name is not a string");
+	claim = g_hash_table_lookup(g_object_get_data(G_OBJECT(apps), "claims"),
+	    entry_id(e));
+	if (claim == NULL || !claim->shown)
 		return FALSE;
-	}
-	name_v = g_value_dup_string(&value);
-	g_value_unset(&value);
-
-	if (strlen(name_v) != strlen(st->name) ||
-	    strncmp(name_v, st->name, strlen(st->name)) != 0)
+	gtk_tree_model_get(GTK_TREE_MODEL(apps), &claim->iter,
+	    ENTRY_COLUMN, &shown, -1);
+	if (shown != e)
 		return FALSE;
 
-	gtk_tree_model_get_value(model, iter, EXEC_COLUMN, &value);
-	if (!G_VALUE_HOLDS_STRING(&value)) {
-		warnx("gtk_tree_model_get_value: exec is not a string");
-		return TRUE;
-	}
-	st->cmd = g_value_dup_string(&value);
-	g_value_unset(&value);
+	free(st->cmd);
+	if ((st->cmd = strdup(entry_store_exec(store, id))) == NULL)
+		err(1, NULL);
+	st->flags = entry_store_fcodes(store, id);
+	st->use_term = entry_store_term(store, id);
 
-	gtk_tree_model_get_value(model, iter, FCODE_COLUMN, &value);
-	if (!G_VALUE_HOLDS_UINT(&value)) {
-		warnx("gtk_tree_model_get_value: flags are not an integer");
-		return TRUE;
-	}
-	st->flags = g_value_get_uint(&value);
-	g_value_unset(&value);
+	set_launch_info(st, GTK_TREE_MODEL(apps), &claim->iter);
 
-	gtk_tree_model_get_value(model, iter, TERM_COLUMN, &value);
-	if (!G_VALUE_HOLDS_BOOLEAN(&value)) {
-		warnx("gtk_tree_model_get_value: term is not a Boolean");
-		return TRUE;
-	}
-	st->use_term = g_value_get_boolean(&value);
-	g_value_unset(&value);
-
-	if (run_cmd(st))
-		return TRUE;
+	run_cmd(st);
 
 	return TRUE;
 }
@@ -299,7 +535,7 @@ handle_response(GtkDialog *dialog, gint response_id, gpointer user_data)
 	if (path == NULL || column == NULL)
 		return;
 
-	app_selected(tree_view, path, column, NULL);
+	gtk_tree_view_row_activated(tree_view, path, column);
 
 	gtk_tree_path_free(path);
 }
@@ -309,19 +545,33 @@ handle_response(GtkDialog *dialog, gint response_id, gpointer user_data)
  */
 GtkWidget *
 apps_tree_new()
+{
+	GtkTreeStore		*apps;
+
+	if ((apps = collect_apps(TRUE)) == NULL)
+	    return NULL;
+
+	return apps_view_new(apps);
+}
+
+/*
+ * Return a GtkTreeView* showing the entries in the GtkTreeStore*.
+ */
+GtkWidget *
+apps_view_new(GtkTreeStore *apps)
 {
 	GtkWidget		*apps_tree;
-	GtkListStore		*apps;
 	GtkTreeViewColumn	*name_col;
 	GValue		 	 g_3 = G_VALUE_INIT;
 	GtkCellRenderer		*cellr;
+	gboolean		 compact;
 
 	g_value_init(&g_3, G_TYPE_INT);
 	g_value_set_int(&g_3, 3);
 
-	if ((apps = collect_apps()) == NULL)
-	    return NULL;
+	/* The view takes over the store. */
 	apps_tree = gtk_tree_view_new_with_model(GTK_TREE_MODEL(apps));
+	g_object_unref(apps);
 
 	cellr = bs_cell_renderer_entry_new();
 	name_col = gtk_tree_view_column_new_with_attributes(
@@ -332,215 +582,820 @@ apps_tree_new()
 	    NULL);
 	g_object_set_property(G_OBJECT(cellr), "xpad", &g_3);
 	g_object_set_property(G_OBJECT(cellr), "ypad", &g_3);
+	gtk_tree_view_column_set_cell_data_func(name_col, cellr,
+	    drop_cell_data, NULL, NULL);
 	gtk_tree_view_append_column(GTK_TREE_VIEW(apps_tree), name_col);
 
+	/*
+	 * Over a slow display connection, every row is one line of text, none
+	 * are measured, and nothing is redrawn just to animate.
+	 */
+	g_object_get(cellr, "compact", &compact, NULL);
+	if (compact) {
+		gtk_tree_view_column_set_sizing(name_col,
+		    GTK_TREE_VIEW_COLUMN_FIXED);
+		gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(apps_tree),
+		    TRUE);
+		g_object_set(gtk_settings_get_default(),
+		    "gtk-enable-animations", FALSE, NULL);
+	}
+
 	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(apps_tree), FALSE);
 	gtk_tree_view_set_enable_search(GTK_TREE_VIEW(apps_tree), TRUE);
 	gtk_tree_view_set_search_column(GTK_TREE_VIEW(apps_tree), 0);
-	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(apps),
-	    NAME_COLUMN, GTK_SORT_ASCENDING);
+	gtk_tree_view_set_search_equal_func(GTK_TREE_VIEW(apps_tree),
+	    search_equal, g_object_get_data(G_OBJECT(apps), "search"), NULL);
+
+	g_signal_connect(apps_tree, "test-expand-row",
+	    G_CALLBACK(expand_actions), NULL);
+
+	gtk_widget_set_has_tooltip(apps_tree, TRUE);
+	g_signal_connect(apps_tree, "query-tooltip", G_CALLBACK(entry_tooltip),
+	    NULL);
 
 	return apps_tree;
 }
 
 /*
- * Return a GtkListStore* populated with data from all desktop entries.
+ * Open the list for --bench-stress, running the selected entry when a row is
+ * activated, as the window does.
  */
-GtkListStore *
-collect_apps()
+GtkWidget *
+stress_open(gpointer data)
 {
-	GtkListStore		*apps;
-	const gchar *const	*dirs;
-	GHashTable		*entry_files;
+	GtkWidget	*apps_tree;
 
-	apps = gtk_list_store_new(NUM_COLUMNS,
-	    G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_BOOLEAN);
-	if (apps == NULL)
-		return NULL;
+	if ((apps_tree = apps_tree_new()) == NULL)
+		errx(1, "could not collect the applications");
+	g_signal_connect(apps_tree, "row-activated", G_CALLBACK(app_selected),
+	    data);
+
+	return apps_tree;
+}
+
+/*
+ * Wait for every applications directory to be read and cached, however long
+ * that takes.
+ */
+void
+apps_wait(GtkWidget *apps_tree)
+{
+	guint		 i;
+	struct scan	*scan;
+
+	scan = g_object_get_data(G_OBJECT(gtk_tree_view_get_model(
+	    GTK_TREE_VIEW(apps_tree))), "scan");
+	for (i = 0; i < scan_len(scan); i++)
+		scan_wait(scan, i, G_MAXINT64);
+}
+
+/*
+ * Whether the row matches the typed search, by name, generic name, keywords,
+ * or comment. Like all GtkTreeViewSearchEqualFuncs, this returns FALSE on a
+ * match.
+ */
+gboolean
+search_equal(GtkTreeModel *model, gint column, const gchar *key,
+    GtkTreeIter *iter, gpointer user_data)
+{
+	guint		 id;
+	char		*name, *fold_name, *fold_key;
+	gboolean	 found = FALSE;
+
+	gtk_tree_model_get(model, iter, ID_COLUMN, &id, -1);
+	if (id != ACTION_ID)
+		return !search_matches(user_data, key, id);
+
+	/* Actions are few and only searched once expanded. */
+	gtk_tree_model_get(model, iter, NAME_COLUMN, &name, -1);
+	if (name) {
+		fold_name = g_utf8_casefold(name, -1);
+		fold_key = g_utf8_casefold(key, -1);
+		found = strstr(fold_name, fold_key) != NULL;
+		g_free(fold_key);
+		g_free(fold_name);
+		g_free(name);
+	}
+
+	return !found;
+}
 
-	entry_files = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+/*
+ * Return a GtkTreeStore* populated with data from all desktop entries. Each
+ * applications directory is read in the background; those that are not read
+ * in time are filled in from their cache, however old, and merged again once
+ * they have been read.
+ *
+ * To revalidate is to not wait at all for a directory that has a cache, but
+ * to show the cache straight away and bring it up to date from the main loop.
+ */
+GtkTreeStore *
+collect_apps(gboolean revalidate)
+{
+	guint		 i;
+	char		**dirs;
+	gint64		 t0, deadline;
+	GtkTreeStore	*apps;
+	struct scan	*scan;
 
-	collect_apps_in_dir(apps, entry_files, g_get_user_data_dir());
+	t0 = g_get_monotonic_time();
 
-	for (dirs = g_get_system_data_dirs(); *dirs; dirs++)
-		collect_apps_in_dir(apps, entry_files, *dirs);
+	if ((apps = apps_store_new()) == NULL)
+		return NULL;
 
-	g_hash_table_unref(entry_files);
+	dirs = apps_dirs();
+	scan = scan_start(dirs);
+	g_strfreev(dirs);
+	g_object_set_data_full(G_OBJECT(apps), "scan", scan,
+	    (GDestroyNotify)scan_unref);
+
+	deadline = g_get_monotonic_time() + SCAN_BUDGET;
+	for (i = 0; i < scan_len(scan); i++) {
+		if (scan_wait(scan, i, 0)) {
+			apps_merge_dir(apps, scan, i);
+			continue;
+		}
 
+		if (!revalidate || scan_stale_entries(scan, i)->len == 0) {
+			if (scan_wait(scan, i, deadline)) {
+				apps_merge_dir(apps, scan, i);
+				continue;
+			}
+			warnx("%s: not read in time; using the cache",
+			    scan_dir(scan, i));
+			metrics_add(METRIC_DIRS_LATE, 1);
+		}
+
+		apps_merge_stale(apps, scan, i);
+		scan_notify(scan, i, apps_merge_late, g_object_ref(apps));
+	}
+
+	metrics_since(METRIC_SCAN_SECONDS, t0);
 	return apps;
 }
 
 /*
- * Populate a GtkListStore* with data from desktop entries appearing in the
- * given data directory.
+ * The applications directories, in order of precedence.
+ */
+char **
+apps_dirs(void)
+{
+	const gchar *const	*data_dirs;
+	GPtrArray		*dirs;
+
+	dirs = g_ptr_array_new();
+	g_ptr_array_add(dirs, g_build_filename(g_get_user_data_dir(),
+	    "applications", NULL));
+	for (data_dirs = g_get_system_data_dirs(); *data_dirs; data_dirs++)
+		g_ptr_array_add(dirs, g_build_filename(*data_dirs,
+		    "applications", NULL));
+	g_ptr_array_add(dirs, NULL);
+
+	return (char **)g_ptr_array_free(dirs, FALSE);
+}
+
+/*
+ * Insert the entries of a directory that has been read.
  */
 void
-collect_apps_in_dir(GtkListStore *apps, GHashTable *entry_files,
-    const char *data_dir)
+apps_merge_dir(GtkTreeStore *apps, struct scan *scan, guint i)
 {
-	DIR	*dirp;
-	char	*dir;
-	int	 ret;
-	size_t	 len;
+	guint	 j;
+	GArray	*entries;
 
-	len = strlen(data_dir) + 14;
-	if ((dir = calloc(len, sizeof(char))) == NULL)
-		err(1, NULL);
-	ret = snprintf(dir, len, "%s/%s", data_dir, "applications");
-	if (ret < 0 || (size_t)ret >= len)
-		err(1, NULL);
+	mime_index_add_dir(g_object_get_data(G_OBJECT(apps), "mime-index"),
+	    scan_dir(scan, i));
+	apps_dir_metrics(scan, i);
 
-	if ((dirp = opendir(dir)) == NULL)
-		goto done;
+	entries = scan_entries(scan, i);
+	for (j = 0; j < entries->len; j++)
+		apps_list_insert_entry(apps, i,
+		    &g_array_index(entries, struct entry, j));
+}
 
-	apps_list_insert_files(apps, entry_files, dir, dirp, len);
+/*
+ * Count what reading a directory took.
+ */
+void
+apps_dir_metrics(struct scan *scan, guint i)
+{
+	guint	 j;
+	GArray	*entries;
 
-	if (dirp && closedir(dirp) < 0)
-		err(1, NULL);
+	metrics_add(scan_cached(scan, i) ? METRIC_DIR_CACHE_HITS :
+	    METRIC_DIR_CACHE_MISSES, 1);
+	metrics_add(METRIC_PARSE_FAILURES, scan_failures(scan, i));
 
-done:
-	free(dir);
+	entries = scan_entries(scan, i);
+	for (j = 0; j < entries->len; j++)
+		if (!g_array_index(entries, struct entry, j).shadowed)
+			metrics_add(METRIC_ENTRIES, 1);
 }
 
 /*
- * Insert all desktop files in a directory into the GtkListStore.
+ * Insert the entries of a directory from its cache, without looking at the
+ * directory itself.
  */
 void
-apps_list_insert_files(GtkListStore *apps, GHashTable *entry_files, char *dir,
-    DIR *dirp, size_t len)
+apps_merge_stale(GtkTreeStore *apps, struct scan *scan, guint i)
 {
-	char		*fn = NULL, *name_v = NULL, *exec_v = NULL;
-	char		*icon_v = NULL;
-	int		 ret;
-	size_t		 len_name, len_fn;
-	uint8_t		 field_code_flags;
-	struct dirent	*dp;
-	GKeyFile	*key_file = NULL;
-	GError		*error = NULL;
-	gboolean	 nodisplay_v, hidden_v, use_term_v;
+	guint	 j;
+	GArray	*entries;
 
-	while ((dp = readdir(dirp)) != NULL) {
-		len_name = strlen(dp->d_name);
-		if (len_name <= 8)
-			goto cont;
-		if (strncmp(dp->d_name + len_name - 8, ".desktop", 8) != 0)
-			goto cont;
+	entries = scan_stale_entries(scan, i);
+	for (j = 0; j < entries->len; j++)
+		apps_list_insert_entry(apps, i,
+		    &g_array_index(entries, struct entry, j));
+}
 
-		len_fn = len_name + len + 1;
-		if ((fn = calloc(len_fn, sizeof(char))) == NULL)
-			err(1, NULL);
-		ret = snprintf(fn, len_fn, "%s/%s", dir, dp->d_name);
-		if (ret < 0 || (size_t)ret >= len_fn)
-			err(1, NULL);
+/*
+ * Bring the entries that came from a directory's cache up to date with those
+ * read from the directory, now that it has been. Only the rows that differ are
+ * touched, so the selection and the search are kept. IDs that the cache
+ * claimed and the directory no longer has go to the next directory that has
+ * them.
+ */
+void
+apps_merge_late(struct scan *scan, guint i, gpointer user_data)
+{
+	guint		 j, k, n;
+	char		*id;
+	GArray		*entries;
+	GPtrArray	*dropped;
+	GHashTable	*claims, *fresh;
+	GHashTableIter	 it;
+	GtkTreeStore	*apps;
+	struct claim	*claim;
+	struct entry	*e, *old;
+
+	apps = user_data;
+	claims = g_object_get_data(G_OBJECT(apps), "claims");
+	dropped = g_ptr_array_new_with_free_func(g_free);
+
+	mime_index_add_dir(g_object_get_data(G_OBJECT(apps), "mime-index"),
+	    scan_dir(scan, i));
+	apps_dir_metrics(scan, i);
+
+	fresh = g_hash_table_new(g_str_hash, g_str_equal);
+	entries = scan_entries(scan, i);
+	for (j = 0; j < entries->len; j++) {
+		e = &g_array_index(entries, struct entry, j);
+		if (!e->shadowed)
+			g_hash_table_insert(fresh, (gpointer)entry_id(e), e);
+	}
 
-		key_file = g_key_file_new();
-		if (!g_key_file_load_from_file(key_file, fn, G_KEY_FILE_NONE, &error))
-			errx(1, "%s", error->message);
-
-		nodisplay_v = g_key_file_get_boolean(key_file,
-		    G_KEY_FILE_DESKTOP_GROUP,
-		    G_KEY_FILE_DESKTOP_KEY_NO_DISPLAY, NULL);
-		if (nodisplay_v != FALSE)
-			goto cont;
-
-		name_v = g_key_file_get_locale_string(key_file,
-		    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME,
-		    NULL, &error);
-		if (name_v == NULL) {
-			warnx("g_key_file_get_locale_string: %s",
-			    error->message);
-			g_clear_error(&error);
-			goto cont;
-		}
+	/* Settle the IDs from the cache, leaving the entries still to claim. */
+	g_hash_table_iter_init(&it, claims);
+	while (g_hash_table_iter_next(&it, (gpointer *)&id,
+	    (gpointer *)&claim)) {
+		if (claim->prio != i)
+			continue;
+
+		if ((e = g_hash_table_lookup(fresh, id)) == NULL) {
+			if (claim->shown)
+				apps_list_remove(apps, claim);
+			g_ptr_array_add(dropped, g_strdup(id));
+			g_hash_table_iter_remove(&it);
+		} else if (claim->shown) {
+			gtk_tree_model_get(GTK_TREE_MODEL(apps), &claim->iter,
+			    ENTRY_COLUMN, &old, -1);
+			if (!entry_equal(old, e))
+				apps_list_update_entry(apps, claim, e);
+			g_hash_table_remove(fresh, id);
+		} else
+			g_hash_table_iter_remove(&it);
+	}
 
-		if (!g_hash_table_add(entry_files, strdup(name_v)))
-			goto cont;
-
-		hidden_v = g_key_file_get_boolean(key_file,
-		    G_KEY_FILE_DESKTOP_GROUP,
-		    G_KEY_FILE_DESKTOP_KEY_HIDDEN, NULL);
-		if (hidden_v != FALSE)
-			goto cont;
-
-		exec_v = g_key_file_get_locale_string(key_file,
-		    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC,
-		    NULL, &error);
-		if (exec_v == NULL) {
-			warnx("g_key_file_get_locale_string: %s",
-			    error->message);
-			g_clear_error(&error);
-			goto cont;
+	g_hash_table_iter_init(&it, fresh);
+	while (g_hash_table_iter_next(&it, NULL, (gpointer *)&e))
+		apps_list_insert_entry(apps, i, e);
+	g_hash_table_unref(fresh);
+
+	for (n = 0; n < dropped->len; n++) {
+		id = g_ptr_array_index(dropped, n);
+		for (j = i + 1; j < scan_len(scan) &&
+		    !g_hash_table_contains(claims, id); j++) {
+			if (!scan_wait(scan, j, 0))
+				continue;
+			entries = scan_entries(scan, j);
+			for (k = 0; k < entries->len; k++) {
+				e = &g_array_index(entries, struct entry, k);
+				if (strcmp(entry_id(e), id) == 0) {
+					apps_list_insert_entry(apps, j, e);
+					break;
+				}
+			}
 		}
+	}
 
-		field_code_flags = field_codes(exec_v);
+	g_ptr_array_free(dropped, TRUE);
+	g_object_unref(apps);
+}
 
-		icon_v = g_key_file_get_locale_string(key_file,
-		    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_ICON,
-		    NULL, &error);
-		g_clear_error(&error);
+/*
+ * Return an empty GtkTreeStore* for desktop entries.
+ */
+GtkTreeStore *
+apps_store_new(void)
+{
+	GtkTreeStore		*apps;
+	struct entry_store	*entries;
 
-		use_term_v = g_key_file_get_boolean(key_file,
-		    G_KEY_FILE_DESKTOP_GROUP,
-		    G_KEY_FILE_DESKTOP_KEY_TERMINAL, NULL);
-		g_clear_error(&error);
+	apps = gtk_tree_store_new(NUM_COLUMNS,
+	    G_TYPE_STRING, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_BOOLEAN,
+	    G_TYPE_POINTER, G_TYPE_UINT, G_TYPE_POINTER, G_TYPE_BOOLEAN,
+	    G_TYPE_BOOLEAN, G_TYPE_POINTER);
+	if (apps == NULL)
+		return NULL;
+
+	/* The collation keys of actions live as long as the store. */
+	g_object_set_data_full(G_OBJECT(apps), "collate-keys",
+	    g_string_chunk_new(4096), (GDestroyNotify)g_string_chunk_free);
+	entries = entry_store_new();
+	g_object_set_data_full(G_OBJECT(apps), "entries", entries,
+	    (GDestroyNotify)entry_store_free);
+	g_object_set_data_full(G_OBJECT(apps), "search", search_new(entries),
+	    (GDestroyNotify)search_free);
+	g_object_set_data_full(G_OBJECT(apps), "order",
+	    g_array_new(FALSE, FALSE, sizeof(guint)),
+	    (GDestroyNotify)g_array_unref);
+	g_object_set_data_full(G_OBJECT(apps), "mime-index", mime_index_new(),
+	    (GDestroyNotify)mime_index_free);
+	g_object_set_data_full(G_OBJECT(apps), "claims",
+	    g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free),
+	    (GDestroyNotify)g_hash_table_unref);
+
+	return apps;
+}
+
+/*
+ * Return a GtkTreeStore* of generated entries for benchmarks. They use the
+ * icons of the installed desktop entries in turn.
+ */
+GtkTreeStore *
+bench_apps(int rows)
+{
+	int		 i;
+	char		*icon, *name, *exec, *collate;
+	GtkTreeStore	*installed, *apps;
+	GtkTreeIter	 iter;
+	GPtrArray	*icons;
+	GStringChunk	*strings;
+	struct entry	*entries, *e;
+
+	icons = g_ptr_array_new_with_free_func(g_free);
+	if ((installed = collect_apps(FALSE)) != NULL) {
+		if (gtk_tree_model_get_iter_first(GTK_TREE_MODEL(installed),
+		    &iter))
+			do {
+				gtk_tree_model_get(GTK_TREE_MODEL(installed),
+				    &iter, ICON_COLUMN, &icon, -1);
+				if (icon)
+					g_ptr_array_add(icons, icon);
+			} while (gtk_tree_model_iter_next(
+			    GTK_TREE_MODEL(installed), &iter));
+		g_object_unref(installed);
+	}
 
-		gtk_list_store_insert_with_values(apps, NULL, -1,
-		    NAME_COLUMN, name_v,
-		    EXEC_COLUMN, exec_v,
-		    FCODE_COLUMN, field_code_flags,
-		    ICON_COLUMN, icon_v,
-		    TERM_COLUMN, use_term_v,
+	if ((apps = apps_store_new()) == NULL)
+		errx(1, "could not create the tree store");
+
+	/* The rows point at their entries, which must outlive them. */
+	if ((entries = calloc(rows, sizeof(struct entry))) == NULL)
+		err(1, NULL);
+	strings = g_string_chunk_new(4096);
+	g_object_set_data_full(G_OBJECT(apps), "bench-entries", entries, free);
+	g_object_set_data_full(G_OBJECT(apps), "bench-strings", strings,
+	    (GDestroyNotify)g_string_chunk_free);
+
+	for (i = 0; i < rows; i++) {
+		name = g_strdup_printf("Entry %d", i);
+		exec = g_strdup_printf("bench-entry-%d %%f", i);
+		collate = g_utf8_collate_key(name, -1);
+
+		e = &entries[i];
+		e->name = g_string_chunk_insert(strings, name);
+		e->exec = g_string_chunk_insert(strings, exec);
+		e->fcodes = SINGLE_FILE_PLACEHOLDER;
+		e->collate = g_string_chunk_insert(strings, collate);
+		if (icons->len)
+			e->icon = g_string_chunk_insert_const(strings,
+			    g_ptr_array_index(icons, i % icons->len));
+
+		apps_list_insert_entry(apps, 0, e);
+
+		g_free(collate);
+		g_free(exec);
+		g_free(name);
+	}
+
+	g_ptr_array_free(icons, TRUE);
+
+	return apps;
+}
+
+/*
+ * Insert one desktop entry from the directory with the given precedence into
+ * the GtkTreeStore, unless an entry with that desktop ID has already been seen
+ * in the same or an earlier directory; one from a later directory is replaced.
+ * Entries that are hidden, whose TryExec cannot be found, or that are not
+ * shown in the current desktop are not inserted, but still shadow any later
+ * entries with the same ID.
+ *
+ * Only what is needed to show, sort, and run the entry is copied into the row.
+ * The row points at the entry for the rest, such as the comment and keywords,
+ * so the entry must live as long as the store.
+ *
+ * The rows are kept in order of their collation keys by inserting each where
+ * it belongs, found from the keys in the entry store, rather than by a sort
+ * function that would have to read every row it compares out of the model.
+ */
+void
+apps_list_insert_entry(GtkTreeStore *apps, guint prio, const struct entry *e)
+{
+	guint			 id, pos;
+	GtkTreeIter		 iter;
+	GArray			*order;
+	GHashTable		*claims;
+	struct claim		*claim;
+	struct entry_store	*store;
+
+	if (e->shadowed)
+		return;
+
+	claims = g_object_get_data(G_OBJECT(apps), "claims");
+	if ((claim = g_hash_table_lookup(claims, entry_id(e))) == NULL) {
+		if ((claim = malloc(sizeof(struct claim))) == NULL)
+			err(1, NULL);
+		g_hash_table_insert(claims, g_strdup(entry_id(e)), claim);
+	} else if (claim->prio <= prio)
+		return;
+	else if (claim->shown)
+		apps_list_remove(apps, claim);
+
+	claim->prio = prio;
+	claim->shown = FALSE;
+
+	if (!apps_entry_shows(e))
+		return;
+
+	store = g_object_get_data(G_OBJECT(apps), "entries");
+	order = g_object_get_data(G_OBJECT(apps), "order");
+	id = entry_store_add(store, e);
+	pos = apps_order_bound(order, store, id, 1);
+	g_array_insert_val(order, pos, id);
+
+	if (e->file && e->mimetypes)
+		mime_index_add_entry(
+		    g_object_get_data(G_OBJECT(apps), "mime-index"), e->file,
+		    e->mimetypes);
+
+	gtk_tree_store_insert_with_values(apps, &iter, NULL, pos,
+	    NAME_COLUMN, e->name,
+	    EXEC_COLUMN, e->exec,
+	    FCODE_COLUMN, e->fcodes,
+	    ICON_COLUMN, e->icon,
+	    TERM_COLUMN, (gboolean)e->use_term,
+	    COLLATE_COLUMN, e->collate ? e->collate : "",
+	    ID_COLUMN, id,
+	    FILE_COLUMN, e->file,
+	    DBUS_COLUMN, (gboolean)e->dbus,
+	    NOTIFY_COLUMN, (gboolean)e->startup_notify,
+	    ENTRY_COLUMN, e,
+	    -1);
+
+	if (e->has_actions && e->file)
+		gtk_tree_store_insert_with_values(apps, NULL, &iter, -1,
+		    ID_COLUMN, ACTION_ID,
 		    -1);
 
-cont:
-		free(exec_v); exec_v = NULL;
-		free(name_v); name_v = NULL;
-		free(icon_v); icon_v = NULL;
-		free(fn); fn = NULL;
-		if (key_file) {
-			g_key_file_free(key_file);
-			key_file = NULL;
-		}
+	claim->shown = TRUE;
+	claim->iter = iter;
+}
+
+/*
+ * Bring the row of an entry up to date with a newer reading of it. The row is
+ * changed in place, and keeps its id in the entry store, so that it stays
+ * selected, unless it is no longer shown. It is only moved if its name now
+ * sorts elsewhere.
+ */
+void
+apps_list_update_entry(GtkTreeStore *apps, struct claim *claim,
+    const struct entry *e)
+{
+	guint			 id, old, pos;
+	GtkTreeIter		 child, next;
+	GArray			*order;
+	struct entry_store	*store;
+
+	if (!apps_entry_shows(e)) {
+		apps_list_remove(apps, claim);
+		return;
+	}
+
+	store = g_object_get_data(G_OBJECT(apps), "entries");
+	order = g_object_get_data(G_OBJECT(apps), "order");
+	gtk_tree_model_get(GTK_TREE_MODEL(apps), &claim->iter, ID_COLUMN, &id,
+	    -1);
+	old = apps_order_find(order, store, id);
+	g_array_remove_index(order, old);
+	entry_store_replace(store, id, e);
+	pos = apps_order_bound(order, store, id, 1);
+	g_array_insert_val(order, pos, id);
+
+	/* The row to go before is still counted after the moved one. */
+	if (pos != old) {
+		if (pos + 1 == order->len)
+			gtk_tree_store_move_before(apps, &claim->iter, NULL);
+		else if (gtk_tree_model_iter_nth_child(GTK_TREE_MODEL(apps),
+		    &next, NULL, pos < old ? pos : pos + 1))
+			gtk_tree_store_move_before(apps, &claim->iter, &next);
 	}
+
+	if (e->file && e->mimetypes)
+		mime_index_add_entry(
+		    g_object_get_data(G_OBJECT(apps), "mime-index"), e->file,
+		    e->mimetypes);
+
+	gtk_tree_store_set(apps, &claim->iter,
+	    NAME_COLUMN, e->name,
+	    EXEC_COLUMN, e->exec,
+	    FCODE_COLUMN, e->fcodes,
+	    ICON_COLUMN, e->icon,
+	    TERM_COLUMN, (gboolean)e->use_term,
+	    COLLATE_COLUMN, e->collate ? e->collate : "",
+	    ID_COLUMN, id,
+	    FILE_COLUMN, e->file,
+	    DBUS_COLUMN, (gboolean)e->dbus,
+	    NOTIFY_COLUMN, (gboolean)e->startup_notify,
+	    ENTRY_COLUMN, e,
+	    -1);
+
+	/* The actions are read again when it is next expanded. */
+	while (gtk_tree_model_iter_children(GTK_TREE_MODEL(apps), &child,
+	    &claim->iter))
+		gtk_tree_store_remove(apps, &child);
+	if (e->has_actions && e->file)
+		gtk_tree_store_insert_with_values(apps, NULL, &claim->iter, -1,
+		    ID_COLUMN, ACTION_ID,
+		    -1);
 }
 
 /*
- * Identify which field code placeholders are used in the exec statement.
+ * Take the row of an entry out of the list.
  */
-uint8_t
-field_codes(char *cmd)
+void
+apps_list_remove(GtkTreeStore *apps, struct claim *claim)
 {
-	uint8_t	flags = 0, found_percent = 0;;
+	guint			 id;
+	GArray			*order;
 
-	for (; *cmd; cmd++) {
-		switch (*cmd) {
-		case '%':
-			found_percent = !found_percent;
-			break;
-		case 'f':
-			if (found_percent)
-				flags |= SINGLE_FILE_PLACEHOLDER;
-			found_percent = 0;
-			break;
-		case 'F':
-			if (found_percent)
-				flags |= MULTI_FILE_PLACEHOLDER;
-			found_percent = 0;
-			break;
-		case 'u':
-			if (found_percent)
-				flags |= SINGLE_URL_PLACEHOLDER;
-			found_percent = 0;
-			break;
-		case 'U':
-			if (found_percent)
-				flags |= MULTI_URL_PLACEHOLDER;
-			found_percent = 0;
-			break;
+	order = g_object_get_data(G_OBJECT(apps), "order");
+	gtk_tree_model_get(GTK_TREE_MODEL(apps), &claim->iter, ID_COLUMN, &id,
+	    -1);
+	g_array_remove_index(order, apps_order_find(order,
+	    g_object_get_data(G_OBJECT(apps), "entries"), id));
+
+	gtk_tree_store_remove(apps, &claim->iter);
+	claim->shown = FALSE;
+}
+
+/*
+ * Where a row goes among the shown ones, which are in order of their
+ * collation keys: before the first with a greater key, or if after is not
+ * set, before the first with an equal one.
+ */
+guint
+apps_order_bound(GArray *order, struct entry_store *store, guint id,
+    int after)
+{
+	int	 c;
+	guint	 lo = 0, hi = order->len, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		c = entry_store_compare(store, g_array_index(order, guint, mid),
+		    id);
+		if (c < 0 || (after && c == 0))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * The position of a shown row.
+ */
+guint
+apps_order_find(GArray *order, struct entry_store *store, guint id)
+{
+	guint	pos;
+
+	for (pos = apps_order_bound(order, store, id, 0);
+	    g_array_index(order, guint, pos) != id; pos++)
+		;
+
+	return pos;
+}
+
+/*
+ * Whether an entry gets a row: it is not hidden, is meant for this desktop,
+ * and its TryExec, if any, is installed.
+ */
+gboolean
+apps_entry_shows(const struct entry *e)
+{
+	if (e->hidden || !desktop_shows(e))
+		return FALSE;
+
+	return e->tryexec == NULL || path_index_has(e->tryexec);
+}
+
+/*
+ * A row is about to be expanded. If its only child is the placeholder, read
+ * the actions from the desktop file and put them in its place. Returns TRUE,
+ * preventing the expansion, if there turn out to be no actions.
+ */
+gboolean
+expand_actions(GtkTreeView *tree_view, GtkTreeIter *iter, GtkTreePath *path,
+    gpointer user_data)
+{
+	char		*name, *icon;
+	const char	*file;
+	gboolean	 use_term;
+	GtkTreeIter	 child;
+	GtkTreeModel	*model;
+
+	model = gtk_tree_view_get_model(tree_view);
+	if (!gtk_tree_model_iter_children(model, &child, iter) ||
+	    gtk_tree_model_iter_n_children(model, iter) != 1)
+		return FALSE;
+
+	gtk_tree_model_get(model, &child, NAME_COLUMN, &name, -1);
+	if (name) {
+		g_free(name);
+		return FALSE;
+	}
+
+	gtk_tree_model_get(model, iter,
+	    ICON_COLUMN, &icon,
+	    TERM_COLUMN, &use_term,
+	    FILE_COLUMN, &file,
+	    -1);
+	apps_tree_insert_actions(GTK_TREE_STORE(model), iter, file, icon,
+	    use_term);
+	g_free(icon);
+
+	gtk_tree_store_remove(GTK_TREE_STORE(model), &child);
+
+	return !gtk_tree_model_iter_has_child(model, iter);
+}
+
+/*
+ * Show the comment of the entry under the pointer, which is only read from the
+ * entry now.
+ */
+gboolean
+entry_tooltip(GtkWidget *widget, gint x, gint y, gboolean keyboard_mode,
+    GtkTooltip *tooltip, gpointer user_data)
+{
+	gboolean		 shown = FALSE;
+	GtkTreeIter		 iter;
+	GtkTreeModel		*model;
+	GtkTreePath		*path;
+	const struct entry	*e;
+
+	if (!gtk_tree_view_get_tooltip_context(GTK_TREE_VIEW(widget), &x, &y,
+	    keyboard_mode, &model, &path, &iter))
+		return FALSE;
+
+	gtk_tree_model_get(model, &iter, ENTRY_COLUMN, &e, -1);
+	if (e && e->comment) {
+		gtk_tooltip_set_text(tooltip, e->comment);
+		gtk_tree_view_set_tooltip_row(GTK_TREE_VIEW(widget), tooltip,
+		    path);
+		shown = TRUE;
+	}
+
+	gtk_tree_path_free(path);
+	return shown;
+}
+
+/*
+ * Insert the actions of the desktop file as children of its row, in order of
+ * their names. They use the icon of the entry unless they have their own, and
+ * run in a terminal if it does.
+ */
+void
+apps_tree_insert_actions(GtkTreeStore *apps, GtkTreeIter *parent,
+    const char *file, const char *icon, gboolean use_term)
+{
+	gint		 pos;
+	char		*group, *name_v, *exec_v, *icon_v, *collate_v, *key;
+	gchar		**actions, **action;
+	GtkTreeIter	 child;
+	GKeyFile	*key_file;
+	GStringChunk	*keys;
+	GError		*error = NULL;
+
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_file(key_file, file, G_KEY_FILE_NONE,
+	    &error)) {
+		warnx("%s: %s", file, error->message);
+		g_clear_error(&error);
+		g_key_file_free(key_file);
+		return;
+	}
+
+	keys = g_object_get_data(G_OBJECT(apps), "collate-keys");
+	actions = g_key_file_get_string_list(key_file, G_KEY_FILE_DESKTOP_GROUP,
+	    "Actions", NULL, NULL);
+
+	for (action = actions; action && *action; action++) {
+		group = g_strdup_printf("Desktop Action %s", *action);
+		name_v = g_key_file_get_locale_string(key_file, group,
+		    G_KEY_FILE_DESKTOP_KEY_NAME, NULL, NULL);
+		exec_v = g_key_file_get_string(key_file, group,
+		    G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
+		icon_v = g_key_file_get_locale_string(key_file, group,
+		    G_KEY_FILE_DESKTOP_KEY_ICON, NULL, NULL);
+
+		if (name_v && exec_v) {
+			collate_v = g_utf8_collate_key(name_v, -1);
+
+			/* There are few; the placeholder has no key. */
+			pos = 0;
+			if (gtk_tree_model_iter_children(GTK_TREE_MODEL(apps),
+			    &child, parent))
+				do {
+					gtk_tree_model_get(GTK_TREE_MODEL(apps),
+					    &child, COLLATE_COLUMN, &key, -1);
+					if (key && strcmp(key, collate_v) > 0)
+						break;
+					pos++;
+				} while (gtk_tree_model_iter_next(
+				    GTK_TREE_MODEL(apps), &child));
+
+			gtk_tree_store_insert_with_values(apps, NULL, parent,
+			    pos,
+			    NAME_COLUMN, name_v,
+			    EXEC_COLUMN, exec_v,
+			    FCODE_COLUMN, field_codes(exec_v),
+			    ICON_COLUMN, icon_v ? icon_v : icon,
+			    TERM_COLUMN, use_term,
+			    COLLATE_COLUMN, g_string_chunk_insert(keys,
+			    collate_v),
+			    ID_COLUMN, ACTION_ID,
+			    -1);
+			g_free(collate_v);
 		}
+
+		g_free(icon_v);
+		g_free(exec_v);
+		g_free(name_v);
+		g_free(group);
 	}
 
-	return flags;
+	g_strfreev(actions);
+	g_key_file_free(key_file);
+}
+
+/*
+ * Note when the list is first drawn.
+ */
+gboolean
+first_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data)
+{
+	metrics_mark(METRIC_FIRST_PAINT_SECONDS);
+	g_signal_handlers_disconnect_by_func(widget, first_draw, user_data);
+
+	return FALSE;
+}
+
+/*
+ * Read ahead the program of the entry under the cursor, which moves as the
+ * user types, so that it starts quickly if chosen.
+ */
+void
+cursor_changed(GtkTreeView *tree_view, gpointer user_data)
+{
+	char		*exec = NULL;
+	GtkTreeIter	 iter;
+	GtkTreeModel	*model;
+	GtkTreePath	*path = NULL;
+
+	gtk_tree_view_get_cursor(tree_view, &path, NULL);
+	model = gtk_tree_view_get_model(tree_view);
+	if (path && gtk_tree_model_get_iter(model, &iter, path))
+		gtk_tree_model_get(model, &iter, EXEC_COLUMN, &exec, -1);
+
+	readahead_hint(exec);
+
+	g_free(exec);
+	if (path)
+		gtk_tree_path_free(path);
 }
 
 /*
@@ -572,9 +1427,14 @@ app_selected(GtkTreeView *tree_view, GtkTreePath *path, GtkTreeViewColumn
 		warnx("gtk_tree_model_get_value: exec is not a string");
 		return;
 	}
+	free(st->cmd);
 	st->cmd = g_value_dup_string(&value);
 	g_value_unset(&value);
 
+	/* The placeholder for actions that are not loaded yet. */
+	if (st->cmd == NULL)
+		return;
+
 	gtk_tree_model_get_value(model, &iter, FCODE_COLUMN, &value);
 	if (!G_VALUE_HOLDS_UINT(&value)) {
 		warnx("gtk_tree_model_get_value: flags are not an integer");
@@ -591,7 +1451,9 @@ app_selected(GtkTreeView *tree_view, GtkTreePath *path, GtkTreeViewColumn
 	st->use_term = g_value_get_boolean(&value);
 	g_value_unset(&value);
 
-	if (run_cmd(st))
+	set_launch_info(st, model, &iter);
+
+	if (run_cmd(st) && gtk_main_level() > 0)
 		gtk_main_quit();
 }
 
@@ -624,46 +1486,95 @@ key_pressed(GtkWidget *widget, GdkEvent *event, gpointer user_data)
 
 /*
  * Handle commands with flags and options, and ultimately run the command.
+ * DBusActivatable applications are asked over the session bus first.
  */
 uint8_t
 run_cmd(struct state *st)
 {
-	char		*new_cmd = NULL;
-
-	new_cmd = strdup(st->cmd);
+	char		 *new_cmd = NULL, *args = NULL;
+	gchar		**uris;
+	struct launch	 *l;
+
+	if (st->drop_uris) {
+		args = uris_to_args(st->drop_uris, st->flags);
+		g_strfreev(st->drop_uris);
+		st->drop_uris = NULL;
+	}
+	else if (st->flags && !st->shift_pressed &&
+	    (args = prompt_args(st->flags)) == NULL)
+		return 0;
 
-	if (st->flags) {
-		if (st->shift_pressed) {
-			new_cmd = fill_in_command(st->cmd, "", st->flags);
-			if (new_cmd == NULL) {
-				warnx("fill_in_command failed");
-				goto done;
-			}
-		} else if (!fill_in_flags(&new_cmd, st->flags))
-			goto done;
+	if (st->flags)
+		new_cmd = fill_in_command(st->cmd, args ? args : "", st->flags);
+	else
+		new_cmd = strdup(st->cmd);
+	if (new_cmd == NULL) {
+		warnx("fill_in_command failed");
+		goto failed;
 	}
 
 	if (st->use_term)
 		if (!add_terminal(&new_cmd))
-			goto done;
+			goto failed;
 
-	exec_cmd(new_cmd);
-	free(new_cmd);
+	if ((l = malloc(sizeof(struct launch))) == NULL)
+		err(1, NULL);
+	l->cmd = new_cmd;
+	l->id = g_strdup(st->id);
+
+	/* A stub launch must not look like one to anything else. */
+	if (stub_exec)
+		l->startup_id = NULL;
+	else
+		l->startup_id = startup_begin(st->label ? st->label : st->cmd,
+		    st->wmclass, st->notify);
+
+	if (st->app_id && stub_exec == NULL) {
+		uris = args_to_uris(args);
+		dbus_app_activate(st->app_id, uris, l->startup_id,
+		    launch_activated, l);
+		g_strfreev(uris);
+	} else
+		launch_activated(0, l);
+
+	g_free(args);
 	return 1;
 
-done:
+failed:
+	metrics_launch(st->id, 0);
+	g_free(args);
 	free(new_cmd);
 	return 0;
 }
 
 /*
- * Get text and use that to fill in the placeholder.
+ * Finish a launch once D-Bus activation is done with, running the command if
+ * the application was not activated.
  */
-uint8_t
-fill_in_flags(char **cmd, uint8_t flags)
+void
+launch_activated(int activated, gpointer data)
+{
+	struct launch	*l = data;
+
+	if (activated)
+		metrics_launch(l->id, 1);
+	else
+		metrics_launch(l->id, exec_cmd(l->cmd, l->startup_id));
+
+	g_free(l->startup_id);
+	g_free(l->id);
+	free(l->cmd);
+	free(l);
+}
+
+/*
+ * Prompt for the text to fill in the placeholder. Returns NULL if the dialog
+ * was closed.
+ */
+char *
+prompt_args(uint8_t flags)
 {
-	uint8_t		 ret = 0;
-	const char	*text = NULL;
+	char		*ret = NULL;
 	GtkWidget	*dialog, *box, *entry, *label = NULL;
 	GtkEntryBuffer	*buf;
 	GValue		 g_9 = G_VALUE_INIT;
@@ -699,6 +1610,7 @@ fill_in_flags(char **cmd, uint8_t flags)
 		label = gtk_label_new("URIs");
 
 	if (label) {
+		path_completion_attach(GTK_ENTRY(entry));
 		gtk_box_pack_start(GTK_BOX(box), label, /* expand */ 0,
 		    /* fill */ 1, /* padding */ 3);
 		gtk_box_pack_start(GTK_BOX(box), entry, /* expand */ 1,
@@ -710,15 +1622,7 @@ fill_in_flags(char **cmd, uint8_t flags)
 	switch (gtk_dialog_run(GTK_DIALOG(dialog))) {
 	case GTK_RESPONSE_OK:
 		buf = gtk_entry_get_buffer(GTK_ENTRY(entry));
-		text = gtk_entry_buffer_get_text(buf);
-
-		if ((*cmd = fill_in_command(*cmd, text, flags)) == NULL) {
-			warnx("fill_in_command failed");
-			break;
-		}
-
-		ret = 1;
-
+		ret = g_strdup(gtk_entry_buffer_get_text(buf));
 		break;
 	case GTK_RESPONSE_CLOSE:
 	case GTK_RESPONSE_NONE:
@@ -734,22 +1638,347 @@ fill_in_flags(char **cmd, uint8_t flags)
 	return ret;
 }
 
+/*
+ * The file names or URIs typed for the placeholder, as URIs for the Open
+ * method. Returns NULL if nothing was typed.
+ */
+gchar **
+args_to_uris(const char *args)
+{
+	int		  argc, i;
+	gchar		**argv, **uris;
+	GFile		 *file;
+
+	if (args == NULL || !g_shell_parse_argv(args, &argc, &argv, NULL))
+		return NULL;
+
+	uris = g_new0(gchar *, argc + 1);
+	for (i = 0; i < argc; i++) {
+		file = g_file_new_for_commandline_arg(argv[i]);
+		uris[i] = g_file_get_uri(file);
+		g_object_unref(file);
+	}
+
+	g_strfreev(argv);
+	return uris;
+}
+
+/*
+ * The dropped URIs as text for the placeholder: local file names for file
+ * placeholders and URIs otherwise, each quoted for the shell. Only the first
+ * is used for a single file or URL.
+ */
+char *
+uris_to_args(gchar **uris, uint8_t flags)
+{
+	char	*fn, *quoted;
+	GString	*args;
+
+	args = g_string_new(NULL);
+	for (; *uris; uris++) {
+		fn = NULL;
+		if (flags & (SINGLE_FILE_PLACEHOLDER | MULTI_FILE_PLACEHOLDER))
+			fn = g_filename_from_uri(*uris, NULL, NULL);
+		quoted = g_shell_quote(fn ? fn : *uris);
+		if (args->len)
+			g_string_append_c(args, ' ');
+		g_string_append(args, quoted);
+		g_free(quoted);
+		g_free(fn);
+
+		if (flags & (SINGLE_FILE_PLACEHOLDER | SINGLE_URL_PLACEHOLDER))
+			break;
+	}
+
+	return g_string_free(args, FALSE);
+}
+
+/*
+ * Something is dragged over the list. Ask for the URIs the first time, and
+ * then accept the drag only over entries that can open them.
+ */
+gboolean
+drag_motion(GtkWidget *widget, GdkDragContext *ctx, gint x, gint y,
+    guint time, gpointer user_data)
+{
+	GtkTreePath	*path;
+
+	if (drop.targets == NULL) {
+		if (!drop.requested) {
+			drop.requested = TRUE;
+			gtk_drag_get_data(widget, ctx,
+			    gdk_atom_intern_static_string("text/uri-list"),
+			    time);
+		}
+		gdk_drag_status(ctx, 0, time);
+		return TRUE;
+	}
+
+	path = drop_target_at(GTK_TREE_VIEW(widget), x, y);
+	gtk_tree_view_set_drag_dest_row(GTK_TREE_VIEW(widget), path,
+	    GTK_TREE_VIEW_DROP_INTO_OR_AFTER);
+	gdk_drag_status(ctx, path ? GDK_ACTION_COPY : 0, time);
+	if (path)
+		gtk_tree_path_free(path);
+
+	return TRUE;
+}
+
+/*
+ * The drag has left the list, or is about to be dropped.
+ */
+void
+drag_leave(GtkWidget *widget, GdkDragContext *ctx, guint time,
+    gpointer user_data)
+{
+	gtk_tree_view_set_drag_dest_row(GTK_TREE_VIEW(widget), NULL, 0);
+	drop_reset();
+	gtk_widget_queue_draw(widget);
+}
+
+/*
+ * Something was dropped on the list. Ask for the URIs again, this time to
+ * run the entry they were dropped on.
+ */
+gboolean
+drag_drop(GtkWidget *widget, GdkDragContext *ctx, gint x, gint y,
+    guint time, gpointer user_data)
+{
+	drop.dropped = TRUE;
+	gtk_drag_get_data(widget, ctx,
+	    gdk_atom_intern_static_string("text/uri-list"), time);
+
+	return TRUE;
+}
+
+/*
+ * The dragged URIs have arrived. Find the entries that can open them and
+ * redraw, dimming the rest; or, if they were dropped on such an entry, run it.
+ */
+void
+drag_data_received(GtkWidget *widget, GdkDragContext *ctx, gint x, gint y,
+    GtkSelectionData *data, guint info, guint time, gpointer user_data)
+{
+	struct state	*st = user_data;
+	GtkTreeModel	*model;
+	GtkTreePath	*path;
+	gboolean	 ran = FALSE;
+
+	model = gtk_tree_view_get_model(GTK_TREE_VIEW(widget));
+
+	g_strfreev(drop.uris);
+	drop.uris = gtk_selection_data_get_uris(data);
+	if (drop.targets)
+		g_hash_table_unref(drop.targets);
+	drop.targets = drop_targets_new(
+	    g_object_get_data(G_OBJECT(model), "mime-index"), drop.uris);
+
+	if (!drop.dropped) {
+		gtk_widget_queue_draw(widget);
+		return;
+	}
+
+	if ((path = drop_target_at(GTK_TREE_VIEW(widget), x, y)) != NULL) {
+		g_strfreev(st->drop_uris);
+		st->drop_uris = g_strdupv(drop.uris);
+		st->shift_pressed = 0;
+		app_selected(GTK_TREE_VIEW(widget), path, NULL, st);
+		gtk_tree_path_free(path);
+		ran = TRUE;
+	}
+
+	gtk_drag_finish(ctx, ran, FALSE, time);
+	drop_reset();
+	gtk_widget_queue_draw(widget);
+}
+
+/*
+ * The path of the entry under the position if it can open the dragged URIs,
+ * or NULL.
+ */
+GtkTreePath *
+drop_target_at(GtkTreeView *tree_view, gint x, gint y)
+{
+	const char		*file, *base;
+	GtkTreeIter		 iter;
+	GtkTreePath		*path = NULL;
+	GtkTreeModel		*model;
+	GtkTreeViewDropPosition	 pos;
+
+	if (drop.targets == NULL ||
+	    !gtk_tree_view_get_dest_row_at_pos(tree_view, x, y, &path, &pos))
+		return NULL;
+
+	model = gtk_tree_view_get_model(tree_view);
+	if (gtk_tree_path_get_depth(path) != 1 ||
+	    !gtk_tree_model_get_iter(model, &iter, path))
+		goto none;
+
+	gtk_tree_model_get(model, &iter, FILE_COLUMN, &file, -1);
+	if (file == NULL)
+		goto none;
+	base = strrchr(file, '/');
+	if (g_hash_table_contains(drop.targets, base ? base + 1 : file))
+		return path;
+
+none:
+	gtk_tree_path_free(path);
+	return NULL;
+}
+
+/*
+ * The set of desktop file names that can open every one of the URIs. Local
+ * files are typed by name, without reading them; other URIs by their scheme.
+ */
+GHashTable *
+drop_targets_new(struct mime_index *idx, gchar **uris)
+{
+	char		*fn, *type, *scheme;
+	gpointer	 file;
+	gboolean	 first = TRUE;
+	GHashTable	*targets, *openers;
+	GHashTableIter	 it;
+
+	targets = g_hash_table_new(g_str_hash, g_str_equal);
+
+	for (; uris && *uris; uris++) {
+		scheme = g_uri_parse_scheme(*uris);
+		if (scheme && strcmp(scheme, "file") != 0)
+			type = g_strconcat("x-scheme-handler/", scheme, NULL);
+		else {
+			fn = g_filename_from_uri(*uris, NULL, NULL);
+			type = g_content_type_guess(fn ? fn : *uris, NULL, 0,
+			    NULL);
+			g_free(fn);
+		}
+		g_free(scheme);
+
+		openers = mime_index_lookup(idx, type);
+		g_free(type);
+
+		if (!first) {
+			g_hash_table_iter_init(&it, openers);
+			while (g_hash_table_iter_next(&it, &file, NULL))
+				if (!g_hash_table_contains(targets, file))
+					g_hash_table_iter_remove(&it);
+		}
+
+		g_hash_table_unref(targets);
+		targets = openers;
+		first = FALSE;
+	}
+
+	return targets;
+}
+
+/*
+ * Forget the current drag.
+ */
+void
+drop_reset(void)
+{
+	g_strfreev(drop.uris);
+	if (drop.targets)
+		g_hash_table_unref(drop.targets);
+
+	drop.uris = NULL;
+	drop.targets = NULL;
+	drop.requested = FALSE;
+	drop.dropped = FALSE;
+}
+
+/*
+ * While something is dragged, dim the entries that cannot open it.
+ */
+void
+drop_cell_data(GtkTreeViewColumn *col, GtkCellRenderer *cellr,
+    GtkTreeModel *model, GtkTreeIter *iter, gpointer user_data)
+{
+	const char	*file = NULL, *base;
+	gboolean	 sensitive = TRUE;
+
+	if (drop.targets) {
+		gtk_tree_model_get(model, iter, FILE_COLUMN, &file, -1);
+		sensitive = FALSE;
+		if (file) {
+			base = strrchr(file, '/');
+			sensitive = g_hash_table_contains(drop.targets,
+			    base ? base + 1 : file);
+		}
+	}
+
+	g_object_set(cellr, "sensitive", sensitive, NULL);
+}
+
+/*
+ * Remember how to launch and follow the program on the row: its desktop ID if
+ * it is DBusActivatable, and its startup notification keys.
+ */
+void
+set_launch_info(struct state *st, GtkTreeModel *model, GtkTreeIter *iter)
+{
+	const struct entry	*e;
+	GtkTreeIter		 parent;
+
+	g_free(st->app_id);
+	g_free(st->label);
+	g_free(st->wmclass);
+	g_free(st->id);
+
+	st->app_id = desktop_id(model, iter);
+	gtk_tree_model_get(model, iter,
+	    NAME_COLUMN, &st->label,
+	    NOTIFY_COLUMN, &st->notify,
+	    ENTRY_COLUMN, &e,
+	    -1);
+	st->wmclass = e ? g_strdup(e->wmclass) : NULL;
+
+	/* Actions are counted against their entry. */
+	if (e == NULL && gtk_tree_model_iter_parent(model, &parent, iter))
+		gtk_tree_model_get(model, &parent, ENTRY_COLUMN, &e, -1);
+	st->id = g_strdup(e ? entry_id(e) : st->label);
+}
+
+/*
+ * The desktop ID of a DBusActivatable row: the file name without .desktop.
+ * Returns NULL for other rows.
+ */
+char *
+desktop_id(GtkTreeModel *model, GtkTreeIter *iter)
+{
+	char		*base, *id;
+	const char	*file;
+	gboolean	 dbus;
+
+	gtk_tree_model_get(model, iter,
+	    FILE_COLUMN, &file,
+	    DBUS_COLUMN, &dbus,
+	    -1);
+	if (!dbus || file == NULL)
+		return NULL;
+
+	base = g_path_get_basename(file);
+	if (g_str_has_suffix(base, ".desktop"))
+		base[strlen(base) - 8] = '\0';
+	id = g_strdup(base);
+	g_free(base);
+
+	return id;
+}
+
 /*
  * Prefix the cmd with a terminal emulator.
  */
 uint8_t
 add_terminal(char **cmd)
 {
-	char	*emulator, *new_cmd;
-	int	 ret;
-	size_t	 len_new_cmd;
+	char		*new_cmd;
+	const char	*emulator;
+	int		 ret;
+	size_t		 len_new_cmd;
 
 	if ((emulator = getenv("TERMINAL")) == NULL)
-		emulator = strdup("xterm");
-	if (emulator == NULL) {
-		warn("getenv or strdup");
-		return 0;
-	}
+		emulator = "xterm";
 
 	len_new_cmd = strlen(*cmd) + strlen(emulator) + 5;
 	if ((new_cmd = calloc(len_new_cmd, sizeof(char))) == NULL) {
@@ -764,19 +1993,23 @@ add_terminal(char **cmd)
 		return 0;
 	}
 
-	*cmd = strdup(new_cmd);
-	free(new_cmd);
+	free(*cmd);
+	*cmd = new_cmd;
 	return 1;
 }
 
 /*
- * Execute the command.
+ * Execute the command, passing on the startup notification ID if there is
+ * one. Returns 0 if it could not be started.
  */
-void
-exec_cmd(const char *cmd)
+int
+exec_cmd(const char *cmd, const char *startup_id)
 {
-	int	 status;
+	int	 status, ok = 0, fds[2] = { -1, -1 };
+	char	 c;
+	ssize_t	 n;
 	pid_t	 pid;
+	char	*path;
 	gchar	**argv;
 	GError	*errors = NULL;
 
@@ -785,36 +2018,77 @@ exec_cmd(const char *cmd)
 			warnx("g_shell_parse_argv: %s", errors->message);
 		else
 			warnx("g_shell_parse_argv failed on: %s", cmd);
-		return;
+		return 0;
+	}
+
+	/* Resolve the command before forking, instead of in execvp(3). */
+	path = path_index_resolve(stub_exec ? stub_exec : argv[0]);
+
+	/*
+	 * The program is told nothing of this pipe; it is closed by a
+	 * successful exec, and written to only if that fails.
+	 */
+	if (pipe(fds) == -1) {
+		warn("pipe");
+		fds[0] = fds[1] = -1;
+	} else {
+		fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+		fcntl(fds[1], F_SETFD, FD_CLOEXEC);
 	}
 
 	switch (pid = fork()) {
 	case -1:
 		warn("fork");
-		return;
+		break;
 	case 0:
 		if (setsid() < 0) {
 			warn("setsid");
-			return;
+			_exit(1);
 		}
 
 		switch (fork()) {
 		case -1:
 			warn("fork");
-			return;
+			_exit(1);
 		case 0:
-			execvp(argv[0], argv);
-			errx(1, "command failed: %s", cmd);
-			break;
+			if (startup_id)
+				setenv("DESKTOP_STARTUP_ID", startup_id, 1);
+			if (path)
+				execv(path, argv);
+			execvp(stub_exec ? stub_exec : argv[0], argv);
+			if (fds[1] != -1)
+				while (write(fds[1], "", 1) == -1 &&
+				    errno == EINTR)
+					;
+			warnx("command failed: %s", cmd);
+			_exit(1);
 		default:
-			exit(0);
+			_exit(0);
 			break;
 		}
 	default:
 		/* parent */
+		if (fds[1] != -1)
+			close(fds[1]);
+		fds[1] = -1;
 		waitpid(pid, &status, 0);
+		ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		if (ok && fds[0] != -1) {
+			while ((n = read(fds[0], &c, 1)) == -1 &&
+			    errno == EINTR)
+				;
+			ok = n != 1;
+		}
 		break;
 	}
+
+	if (fds[0] != -1)
+		close(fds[0]);
+	if (fds[1] != -1)
+		close(fds[1]);
+	g_free(path);
+	g_strfreev(argv);
+	return ok;
 }
 
 /*
@@ -823,37 +2097,27 @@ exec_cmd(const char *cmd)
 char *
 fill_in_command(const char *cmd, const char *interp, uint8_t flags)
 {
-	char		*new_cmd = NULL, *p;
-	const char	*placeholder;
-	size_t		 len_cmd, len_interp, len_ph, len_p;
+	char		*new_cmd;
+	const char	*placeholder, *p;
+	size_t		 len;
 
 	placeholder = placeholder_from_flags(flags);
-	if (!*placeholder)
-		return (char *)cmd;
+	if (placeholder == NULL || !*placeholder)
+		return strdup(cmd);
 
 	if ((p = strstr(cmd, placeholder)) == NULL)
-		return (char *)cmd;
-
-	len_p = strlen(p);
-	len_ph = strlen(placeholder);
-	len_cmd = strlen(cmd);
-	len_interp = strlen(interp);
+		return strdup(cmd);
 
-	if ((new_cmd = calloc(len_cmd - len_ph + len_interp, sizeof(char))) == NULL) {
-		warn("calloc");
-		goto err;
+	len = strlen(cmd) - strlen(placeholder) + strlen(interp) + 1;
+	if ((new_cmd = malloc(len)) == NULL) {
+		warn("malloc");
+		return NULL;
 	}
 
-	strlcpy(new_cmd, cmd, len_cmd + len_p + 1);
-	snprintf(new_cmd + (p - cmd), len_interp + len_p-len_ph + 1, "%s%s",
-	    interp, p + 2);
+	snprintf(new_cmd, len, "%.*s%s%s", (int)(p - cmd), cmd, interp,
+	    p + strlen(placeholder));
 
 	return new_cmd;
-
-err:
-	free(p);
-	free(new_cmd);
-	return NULL;
 }
 
 /*
@@ -0,0 +1,401 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+/*
+ * Counters and timings for monitoring many desktops at once. They are kept in
+ * memory, where recording one is an addition or a clock read, and written at
+ * exit in the Prometheus text format to $BYTESTREAM_METRICS_DIR, for the
+ * textfile collector of node_exporter.
+ *
+ * Each run replaces the file. Gauges describe the last run; counters are
+ * carried over from the file being replaced, so they grow across runs. Runs
+ * that exit together take turns through a lock file beside it, so that none
+ * loses the counts of another.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/file.h>
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "metrics.h"
+#include "compat.h"
+
+#define METRICS_FILE	"bytestream.prom"
+#define METRICS_LOCK	"bytestream.prom.lock"
+
+#define LAUNCHES	"bytestream_launches_total"
+#define FAILURES	"bytestream_launch_failures_total"
+
+struct metric_info {
+	const char	*name;
+	const char	*help;
+	int		 counter;	/* Otherwise a gauge */
+	int		 seconds;	/* Kept in microseconds */
+};
+
+struct launches {
+	guint64	launched;
+	guint64	failed;
+};
+
+static const struct metric_info	 metric_info[NUM_METRICS] = {
+	[METRIC_ENTRIES] = { "bytestream_entries",
+	    "Desktop entries read at the last start.", 0, 0 },
+	[METRIC_SCAN_SECONDS] = { "bytestream_scan_seconds",
+	    "Time taken to collect the applications at the last start.", 0, 1 },
+	[METRIC_FIRST_PAINT_SECONDS] = { "bytestream_first_paint_seconds",
+	    "Time from the last start to the first paint of the list.", 0, 1 },
+	[METRIC_PARSE_FAILURES] = { "bytestream_parse_failures_total",
+	    "Desktop files that could not be parsed.", 1, 0 },
+	[METRIC_DIR_CACHE_HITS] = { "bytestream_dir_cache_hits_total",
+	    "Applications directories read from their cache.", 1, 0 },
+	[METRIC_DIR_CACHE_MISSES] = { "bytestream_dir_cache_misses_total",
+	    "Applications directories read from their desktop files.", 1, 0 },
+	[METRIC_DIRS_LATE] = { "bytestream_dirs_late_total",
+	    "Applications directories not read by the deadline.", 1, 0 },
+	[METRIC_ICON_CACHE_HITS] = { "bytestream_icon_cache_hits_total",
+	    "Distinct icons found in the icon theme caches.", 1, 0 },
+	[METRIC_ICON_CACHE_MISSES] = { "bytestream_icon_cache_misses_total",
+	    "Distinct icons not in the icon theme caches.", 1, 0 },
+};
+
+static int		 metrics_lock(const char *);
+static GHashTable	*metrics_totals(const char *);
+static void		 metrics_total(GHashTable *, const char *, guint64);
+static void		 metrics_family(GString *, GHashTable *, const char *,
+    const char *);
+static char		*metrics_series(const char *, const char *);
+static gint		 metrics_compare(gconstpointer, gconstpointer);
+
+static gint64		 started;
+static guint64		 values[NUM_METRICS];
+static GHashTable	*launches = NULL;
+
+/*
+ * Note the time the program started, which the marks are relative to.
+ */
+void
+metrics_start(void)
+{
+	started = g_get_monotonic_time();
+}
+
+/*
+ * Add to a counter, or set a count.
+ */
+void
+metrics_add(enum metric m, guint64 n)
+{
+	values[m] += n;
+}
+
+/*
+ * Set a timing to the time since t0 on the monotonic clock.
+ */
+void
+metrics_since(enum metric m, gint64 t0)
+{
+	values[m] = g_get_monotonic_time() - t0;
+}
+
+/*
+ * Set a timing to the time since the program started, if it is not set yet.
+ */
+void
+metrics_mark(enum metric m)
+{
+	if (values[m] == 0)
+		values[m] = g_get_monotonic_time() - started;
+}
+
+/*
+ * Count a launch of the desktop entry with the given ID, and whether it
+ * failed.
+ */
+void
+metrics_launch(const char *id, int ok)
+{
+	struct launches	*l;
+
+	if (id == NULL)
+		id = "";
+
+	if (launches == NULL)
+		launches = g_hash_table_new_full(g_str_hash, g_str_equal,
+		    g_free, free);
+
+	if ((l = g_hash_table_lookup(launches, id)) == NULL) {
+		if ((l = calloc(1, sizeof(struct launches))) == NULL)
+			err(1, NULL);
+		g_hash_table_insert(launches, g_strdup(id), l);
+	}
+
+	l->launched++;
+	if (!ok)
+		l->failed++;
+}
+
+/*
+ * Replace the metrics file, if there is a directory for it, adding the
+ * counters to those already in it.
+ */
+void
+metrics_write(void)
+{
+	int			 m, lock;
+	char			*fn, *series;
+	const char		*dir, *id;
+	GString			*out;
+	GHashTable		*totals;
+	GHashTableIter		 it;
+	GError			*error = NULL;
+	struct launches		*l;
+
+	if ((dir = getenv("BYTESTREAM_METRICS_DIR")) == NULL || *dir == '\0')
+		return;
+
+	fn = g_build_filename(dir, METRICS_FILE, NULL);
+	lock = metrics_lock(dir);
+	totals = metrics_totals(fn);
+	out = g_string_new(NULL);
+
+	for (m = 0; m < NUM_METRICS; m++) {
+		if (metric_info[m].counter) {
+			metrics_total(totals, metric_info[m].name, values[m]);
+			metrics_family(out, totals, metric_info[m].name,
+			    metric_info[m].help);
+			continue;
+		}
+
+		g_string_append_printf(out, "# HELP %s %s\n# TYPE %s gauge\n",
+		    metric_info[m].name, metric_info[m].help,
+		    metric_info[m].name);
+		if (metric_info[m].seconds)
+			g_string_append_printf(out, "%s %.6f\n",
+			    metric_info[m].name, values[m] / 1e6);
+		else
+			g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n",
+			    metric_info[m].name, values[m]);
+	}
+
+	if (launches) {
+		g_hash_table_iter_init(&it, launches);
+		while (g_hash_table_iter_next(&it, (gpointer *)&id,
+		    (gpointer *)&l)) {
+			series = metrics_series(LAUNCHES, id);
+			metrics_total(totals, series, l->launched);
+			g_free(series);
+			series = metrics_series(FAILURES, id);
+			metrics_total(totals, series, l->failed);
+			g_free(series);
+		}
+	}
+	metrics_family(out, totals, LAUNCHES,
+	    "Launches of each desktop entry.");
+	metrics_family(out, totals, FAILURES,
+	    "Launches of each desktop entry that failed.");
+
+	g_string_append_printf(out,
+	    "# HELP bytestream_last_run_timestamp_seconds "
+	    "When these metrics were written.\n"
+	    "# TYPE bytestream_last_run_timestamp_seconds gauge\n"
+	    "bytestream_last_run_timestamp_seconds %.3f\n",
+	    g_get_real_time() / 1e6);
+
+	/* Written to a temporary file and renamed over the old one. */
+	if (!g_file_set_contents(fn, out->str, out->len, &error)) {
+		warnx("%s: %s", fn, error->message);
+		g_clear_error(&error);
+	}
+
+	/* Closing it releases the lock. */
+	if (lock != -1)
+		close(lock);
+
+	g_string_free(out, TRUE);
+	g_hash_table_unref(totals);
+	g_free(fn);
+}
+
+/*
+ * The counters in the metrics file, keyed by their series: the name and the
+ * labels, exactly as written.
+ */
+GHashTable *
+metrics_totals(const char *fn)
+{
+	char		*contents, *line, *sp, *end, **lines;
+	guint64		 n, *value;
+	size_t		 len;
+	GHashTable	*totals;
+	int		 i;
+
+	totals = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	if (!g_file_get_contents(fn, &contents, NULL, NULL))
+		return totals;
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (i = 0; lines[i]; i++) {
+		line = lines[i];
+		if (*line == '#' || (sp = strrchr(line, ' ')) == NULL)
+			continue;
+		*sp = '\0';
+
+		/* Only counters carry over. */
+		len = strcspn(line, "{");
+		if (len < 6 || strncmp(line + len - 6, "_total", 6) != 0)
+			continue;
+
+		n = g_ascii_strtoull(sp + 1, &end, 10);
+		if (end == sp + 1 || *end != '\0')
+			continue;
+
+		if ((value = malloc(sizeof(guint64))) == NULL)
+			err(1, NULL);
+		*value = n;
+		g_hash_table_replace(totals, g_strdup(line), value);
+	}
+
+	g_strfreev(lines);
+	g_free(contents);
+	return totals;
+}
+
+/*
+ * Wait for the lock on the metrics in the directory, and return its
+ * descriptor. Returns -1 if there is no lock to be had; the file is then
+ * written regardless.
+ */
+int
+metrics_lock(const char *dir)
+{
+	int	 fd;
+	char	*fn;
+
+	fn = g_build_filename(dir, METRICS_LOCK, NULL);
+	if ((fd = open(fn, O_RDWR | O_CREAT, 0644)) == -1) {
+		warn("%s", fn);
+		g_free(fn);
+		return -1;
+	}
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	while (flock(fd, LOCK_EX) == -1)
+		if (errno != EINTR) {
+			warn("flock: %s", fn);
+			close(fd);
+			fd = -1;
+			break;
+		}
+
+	g_free(fn);
+	return fd;
+}
+
+/*
+ * Add to the total of a series.
+ */
+void
+metrics_total(GHashTable *totals, const char *series, guint64 n)
+{
+	guint64	*value;
+
+	if ((value = g_hash_table_lookup(totals, series)) == NULL) {
+		if ((value = calloc(1, sizeof(guint64))) == NULL)
+			err(1, NULL);
+		g_hash_table_insert(totals, g_strdup(series), value);
+	}
+
+	*value += n;
+}
+
+/*
+ * Write out the series of a counter, in order.
+ */
+void
+metrics_family(GString *out, GHashTable *totals, const char *name,
+    const char *help)
+{
+	char		*series;
+	size_t		 len;
+	GList		*keys, *k;
+
+	g_string_append_printf(out, "# HELP %s %s\n# TYPE %s counter\n",
+	    name, help, name);
+
+	len = strlen(name);
+	keys = g_list_sort(g_hash_table_get_keys(totals), metrics_compare);
+	for (k = keys; k; k = k->next) {
+		series = k->data;
+		if (strncmp(series, name, len) != 0 ||
+		    (series[len] != '\0' && series[len] != '{'))
+			continue;
+		g_string_append_printf(out, "%s %" G_GUINT64_FORMAT "\n",
+		    series, *(guint64 *)g_hash_table_lookup(totals, series));
+	}
+	g_list_free(keys);
+}
+
+/*
+ * The series of a counter for one desktop entry, with the ID escaped as a
+ * label value.
+ */
+char *
+metrics_series(const char *name, const char *id)
+{
+	GString	*s;
+
+	s = g_string_new(name);
+	g_string_append(s, "{entry=\"");
+	for (; *id; id++)
+		switch (*id) {
+		case '\\':
+			g_string_append(s, "\\\\");
+			break;
+		case '"':
+			g_string_append(s, "\\\"");
+			break;
+		case '\n':
+			g_string_append(s, "\\n");
+			break;
+		default:
+			g_string_append_c(s, *id);
+		}
+	g_string_append(s, "\"}");
+
+	return g_string_free(s, FALSE);
+}
+
+gint
+metrics_compare(gconstpointer a, gconstpointer b)
+{
+	return strcmp(a, b);
+}
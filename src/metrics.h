@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include <glib.h>
+
+enum metric {
+	METRIC_ENTRIES,
+	METRIC_SCAN_SECONDS,
+	METRIC_FIRST_PAINT_SECONDS,
+	METRIC_PARSE_FAILURES,
+	METRIC_DIR_CACHE_HITS,
+	METRIC_DIR_CACHE_MISSES,
+	METRIC_DIRS_LATE,
+	METRIC_ICON_CACHE_HITS,
+	METRIC_ICON_CACHE_MISSES,
+	NUM_METRICS,
+};
+
+void	metrics_start(void);
+void	metrics_add(enum metric, guint64);
+void	metrics_since(enum metric, gint64);
+void	metrics_mark(enum metric);
+void	metrics_launch(const char *, int);
+void	metrics_write(void);
+
+#endif /* _METRICS_H */
@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Which desktop files can open a MIME type. The mimeinfo.cache written by
+ * update-desktop-database(1) in each applications directory is mmapped, and
+ * only parsed into the hash table the first time a type is looked up. For
+ * directories without one, the MimeType keys collected while scanning are
+ * used instead.
+ *
+ * A type can also be opened by anything that opens one of its parents, as
+ * an editor of text/plain opens text/x-csrc. The parents and aliases come
+ * from the subclasses and aliases files of shared-mime-info, read once.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "mimeindex.h"
+#include "compat.h"
+
+struct mime_map {
+	char	*map;
+	size_t	 len;
+};
+
+struct mime_index {
+	GArray		*maps;		/* Unparsed mimeinfo.cache files */
+	GHashTable	*types;		/* Type to GPtrArray of desktop files */
+	GHashTable	*covered;	/* Directories with a mimeinfo.cache */
+	GStringChunk	*strings;	/* The types and desktop file names */
+	GHashTable	*parents;	/* Type to GPtrArray of its parents */
+	GHashTable	*aliases;	/* Type to GPtrArray of its aliases */
+};
+
+static void	 mime_index_parse(struct mime_index *, struct mime_map *);
+static void	 mime_index_add(struct mime_index *, const char *, size_t,
+    const char *, size_t);
+static void	 mime_index_load_db(struct mime_index *);
+static void	 mime_index_load_pairs(struct mime_index *, const char *,
+    GHashTable *, int);
+static void	 mime_index_relate(struct mime_index *, GHashTable *,
+    const char *, const char *);
+static GPtrArray *mime_index_ancestors(struct mime_index *, const char *);
+
+/*
+ * An empty index.
+ */
+struct mime_index *
+mime_index_new(void)
+{
+	struct mime_index	*idx;
+
+	if ((idx = malloc(sizeof(struct mime_index))) == NULL)
+		err(1, NULL);
+
+	idx->maps = g_array_new(FALSE, FALSE, sizeof(struct mime_map));
+	idx->types = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	    (GDestroyNotify)g_ptr_array_unref);
+	idx->covered = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	    NULL);
+	idx->strings = g_string_chunk_new(4096);
+	idx->parents = NULL;
+	idx->aliases = NULL;
+
+	return idx;
+}
+
+/*
+ * Free the index, unmapping any unparsed files.
+ */
+void
+mime_index_free(struct mime_index *idx)
+{
+	guint		 i;
+	struct mime_map	*m;
+
+	if (idx == NULL)
+		return;
+
+	for (i = 0; i < idx->maps->len; i++) {
+		m = &g_array_index(idx->maps, struct mime_map, i);
+		munmap(m->map, m->len);
+	}
+
+	g_array_free(idx->maps, TRUE);
+	g_hash_table_unref(idx->types);
+	g_hash_table_unref(idx->covered);
+	if (idx->parents) {
+		g_hash_table_unref(idx->parents);
+		g_hash_table_unref(idx->aliases);
+	}
+	g_string_chunk_free(idx->strings);
+	free(idx);
+}
+
+/*
+ * Map the mimeinfo.cache of an applications directory. Returns 0 if there is
+ * none, in which case the entries of the directory should be added instead.
+ */
+int
+mime_index_add_dir(struct mime_index *idx, const char *dir)
+{
+	int		 fd;
+	char		*fn;
+	struct stat	 sb;
+	struct mime_map	 m;
+
+	fn = g_build_filename(dir, "mimeinfo.cache", NULL);
+	fd = open(fn, O_RDONLY);
+	g_free(fn);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &sb) < 0 || sb.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	m.len = sb.st_size;
+	m.map = mmap(NULL, m.len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (m.map == MAP_FAILED)
+		return 0;
+
+	g_array_append_val(idx->maps, m);
+	g_hash_table_add(idx->covered, g_strdup(dir));
+
+	return 1;
+}
+
+/*
+ * Add the semicolon-separated MimeType of a desktop file, unless its
+ * directory has a mimeinfo.cache.
+ */
+void
+mime_index_add_entry(struct mime_index *idx, const char *file,
+    const char *mimetypes)
+{
+	char		*dir;
+	const char	*base, *end;
+	gboolean	 covered;
+
+	dir = g_path_get_dirname(file);
+	covered = g_hash_table_contains(idx->covered, dir);
+	g_free(dir);
+	if (covered)
+		return;
+
+	base = strrchr(file, '/');
+	base = base ? base + 1 : file;
+
+	for (; *mimetypes; mimetypes = *end ? end + 1 : end) {
+		if ((end = strchr(mimetypes, ';')) == NULL)
+			end = mimetypes + strlen(mimetypes);
+		if (end > mimetypes)
+			mime_index_add(idx, mimetypes, end - mimetypes, base,
+			    strlen(base));
+	}
+}
+
+/*
+ * The set of desktop file names, such as "firefox.desktop", that can open the
+ * type or one of the types it is a subclass of. The names belong to the index.
+ */
+GHashTable *
+mime_index_lookup(struct mime_index *idx, const char *type)
+{
+	guint		 i, j;
+	GPtrArray	*files, *types;
+	GHashTable	*openers;
+	struct mime_map	*m;
+
+	for (i = 0; i < idx->maps->len; i++) {
+		m = &g_array_index(idx->maps, struct mime_map, i);
+		mime_index_parse(idx, m);
+		munmap(m->map, m->len);
+	}
+	g_array_set_size(idx->maps, 0);
+
+	openers = g_hash_table_new(g_str_hash, g_str_equal);
+
+	types = mime_index_ancestors(idx, type);
+	for (i = 0; i < types->len; i++) {
+		if ((files = g_hash_table_lookup(idx->types,
+		    g_ptr_array_index(types, i))) == NULL)
+			continue;
+		for (j = 0; j < files->len; j++)
+			g_hash_table_add(openers, g_ptr_array_index(files, j));
+	}
+	g_ptr_array_free(types, TRUE);
+
+	return openers;
+}
+
+/*
+ * The type, every name it goes by, and all of their ancestors, each once.
+ * Besides the declared parents, every text type is a kind of text/plain and
+ * every type but the inode ones a kind of application/octet-stream.
+ */
+GPtrArray *
+mime_index_ancestors(struct mime_index *idx, const char *type)
+{
+	guint		 i, j;
+	const char	*t;
+	GPtrArray	*types, *related;
+	GHashTable	*seen;
+
+	if (idx->parents == NULL)
+		mime_index_load_db(idx);
+
+	types = g_ptr_array_new();
+	seen = g_hash_table_new(g_str_hash, g_str_equal);
+
+	g_ptr_array_add(types, (gpointer)type);
+	g_hash_table_add(seen, (gpointer)type);
+	for (i = 0; i < types->len; i++) {
+		t = g_ptr_array_index(types, i);
+
+		if ((related = g_hash_table_lookup(idx->aliases, t)) != NULL)
+			for (j = 0; j < related->len; j++)
+				if (g_hash_table_add(seen,
+				    g_ptr_array_index(related, j)))
+					g_ptr_array_add(types,
+					    g_ptr_array_index(related, j));
+
+		if ((related = g_hash_table_lookup(idx->parents, t)) != NULL)
+			for (j = 0; j < related->len; j++)
+				if (g_hash_table_add(seen,
+				    g_ptr_array_index(related, j)))
+					g_ptr_array_add(types,
+					    g_ptr_array_index(related, j));
+
+		if (strncmp(t, "text/", 5) == 0 &&
+		    g_hash_table_add(seen, "text/plain"))
+			g_ptr_array_add(types, "text/plain");
+	}
+
+	if (strncmp(type, "inode/", 6) != 0 &&
+	    g_hash_table_add(seen, "application/octet-stream"))
+		g_ptr_array_add(types, "application/octet-stream");
+
+	g_hash_table_unref(seen);
+	return types;
+}
+
+/*
+ * Read the subclasses and aliases files of every shared-mime-info database,
+ * the user's first.
+ */
+void
+mime_index_load_db(struct mime_index *idx)
+{
+	const gchar *const	*dirs;
+	char			*dir;
+
+	idx->parents = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	    (GDestroyNotify)g_ptr_array_unref);
+	idx->aliases = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+	    (GDestroyNotify)g_ptr_array_unref);
+
+	dir = g_build_filename(g_get_user_data_dir(), "mime", NULL);
+	mime_index_load_pairs(idx, dir, idx->parents, 0);
+	mime_index_load_pairs(idx, dir, idx->aliases, 1);
+	g_free(dir);
+
+	for (dirs = g_get_system_data_dirs(); *dirs; dirs++) {
+		dir = g_build_filename(*dirs, "mime", NULL);
+		mime_index_load_pairs(idx, dir, idx->parents, 0);
+		mime_index_load_pairs(idx, dir, idx->aliases, 1);
+		g_free(dir);
+	}
+}
+
+/*
+ * Add the "type other" lines of the subclasses file, or of the aliases file,
+ * which are related both ways.
+ */
+void
+mime_index_load_pairs(struct mime_index *idx, const char *dir,
+    GHashTable *rel, int aliases)
+{
+	char	*fn, *contents, *line, *next, *sp;
+
+	fn = g_build_filename(dir, aliases ? "aliases" : "subclasses", NULL);
+	if (!g_file_get_contents(fn, &contents, NULL, NULL)) {
+		g_free(fn);
+		return;
+	}
+	g_free(fn);
+
+	for (line = contents; *line; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		if (*line == '#' || (sp = strchr(line, ' ')) == NULL)
+			continue;
+		*sp++ = '\0';
+
+		mime_index_relate(idx, rel, line, sp);
+		if (aliases)
+			mime_index_relate(idx, rel, sp, line);
+	}
+
+	g_free(contents);
+}
+
+/*
+ * Record that the type leads to the other, unless that is already known.
+ */
+void
+mime_index_relate(struct mime_index *idx, GHashTable *rel, const char *type,
+    const char *other)
+{
+	guint		 i;
+	GPtrArray	*to;
+
+	if ((to = g_hash_table_lookup(rel, type)) == NULL) {
+		to = g_ptr_array_new();
+		g_hash_table_insert(rel,
+		    g_string_chunk_insert_const(idx->strings, type), to);
+	}
+
+	for (i = 0; i < to->len; i++)
+		if (strcmp(g_ptr_array_index(to, i), other) == 0)
+			return;
+	g_ptr_array_add(to, g_string_chunk_insert_const(idx->strings, other));
+}
+
+/*
+ * Add the type=file;file; lines of a mimeinfo.cache to the table.
+ */
+void
+mime_index_parse(struct mime_index *idx, struct mime_map *m)
+{
+	const char	*p, *end, *eol, *eq, *name, *semi;
+
+	end = m->map + m->len;
+	for (p = m->map; p < end; p = eol + 1) {
+		if ((eol = memchr(p, '\n', end - p)) == NULL)
+			eol = end;
+		if (*p == '[' || *p == '#' ||
+		    (eq = memchr(p, '=', eol - p)) == NULL || eq == p)
+			continue;
+
+		for (name = eq + 1; name < eol; name = semi + 1) {
+			if ((semi = memchr(name, ';', eol - name)) == NULL)
+				semi = eol;
+			if (semi > name)
+				mime_index_add(idx, p, eq - p, name,
+				    semi - name);
+		}
+	}
+}
+
+/*
+ * Record that the desktop file can open the type.
+ */
+void
+mime_index_add(struct mime_index *idx, const char *type, size_t len_type,
+    const char *file, size_t len_file)
+{
+	char		*s;
+	GPtrArray	*files;
+
+	s = g_strndup(type, len_type);
+	if ((files = g_hash_table_lookup(idx->types, s)) == NULL) {
+		files = g_ptr_array_new();
+		g_hash_table_insert(idx->types,
+		    g_string_chunk_insert(idx->strings, s), files);
+	}
+	g_free(s);
+
+	s = g_strndup(file, len_file);
+	g_ptr_array_add(files, g_string_chunk_insert_const(idx->strings, s));
+	g_free(s);
+}
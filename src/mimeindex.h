@@ -0,0 +1,31 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _MIMEINDEX_H
+#define _MIMEINDEX_H
+
+#include <glib.h>
+
+struct mime_index;
+
+struct mime_index	*mime_index_new(void);
+void			 mime_index_free(struct mime_index *);
+int			 mime_index_add_dir(struct mime_index *, const char *);
+void			 mime_index_add_entry(struct mime_index *, const char *,
+    const char *);
+GHashTable		*mime_index_lookup(struct mime_index *, const char *);
+
+#endif /* _MIMEINDEX_H */
@@ -0,0 +1,387 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * An index of the commands in the directories named by $PATH, built from the
+ * directory listings and cached across runs for as long as none of the
+ * directories change. Looking a command up costs a hash lookup and a stat(2)
+ * of the file found, instead of a stat(2) per directory.
+ *
+ * Files are not stat(2)ed while listing, so anything in a $PATH directory that
+ * is not itself a directory is indexed. Whether it can be run is only checked
+ * when it is looked up, and if it cannot, the later directories are tried as
+ * execvp(3) would.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "pathindex.h"
+#include "compat.h"
+
+#define PATH_INDEX_MAGIC	0x42534550	/* "BSEP" */
+#define PATH_INDEX_VERSION	2
+
+/*
+ * The index file starts with this header, followed by $PATH, followed by the
+ * mtime of each directory. Then come the commands: each is the index of its
+ * directory, as a uint32_t, and the NUL-terminated name.
+ */
+struct path_index_header {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	ndirs;
+	uint32_t	len_path;	/* Length of $PATH, including NUL */
+};
+
+static void	 path_index_init(void);
+static char	*path_index_find(const char *);
+static int	 path_index_runnable(const char *);
+static char	*path_index_file(const char *);
+static int	 path_index_load(const char *, const char *, int64_t *);
+static void	 path_index_list(int64_t *);
+static void	 path_index_save(const char *, const char *, int64_t *);
+
+static gchar		**dirs = NULL;	/* The $PATH directories */
+static guint		  ndirs = 0;
+static GHashTable	 *commands = NULL;	/* Name to dir index + 1 */
+static gchar		 *contents = NULL;	/* Names from the index file */
+static GStringChunk	 *names = NULL;		/* Names from the listings */
+
+/*
+ * Whether the command can be found and run, as for TryExec: a path is checked
+ * directly, and a bare name is looked up in the index.
+ */
+int
+path_index_has(const char *cmd)
+{
+	char	*fn;
+
+	if (strchr(cmd, '/'))
+		return path_index_runnable(cmd);
+
+	if ((fn = path_index_find(cmd)) == NULL)
+		return 0;
+
+	g_free(fn);
+	return 1;
+}
+
+/*
+ * The absolute path to a bare command name, or NULL if it is not in the
+ * index, cannot be run, or is already a path.
+ */
+char *
+path_index_resolve(const char *cmd)
+{
+	if (strchr(cmd, '/'))
+		return NULL;
+
+	return path_index_find(cmd);
+}
+
+/*
+ * The first file by the name in the $PATH directories that can be run,
+ * starting from the directory the index has it in.
+ */
+char *
+path_index_find(const char *cmd)
+{
+	guint	 i;
+	char	*fn;
+
+	path_index_init();
+	if ((i = GPOINTER_TO_UINT(g_hash_table_lookup(commands, cmd))) == 0)
+		return NULL;
+
+	for (i--; i < ndirs; i++) {
+		fn = g_build_filename(dirs[i], cmd, NULL);
+		if (path_index_runnable(fn))
+			return fn;
+		g_free(fn);
+	}
+
+	return NULL;
+}
+
+/*
+ * Whether the file is a regular file that this user may execute.
+ */
+int
+path_index_runnable(const char *fn)
+{
+	struct stat	sb;
+
+	return stat(fn, &sb) == 0 && S_ISREG(sb.st_mode) &&
+	    access(fn, X_OK) == 0;
+}
+
+/*
+ * Build the index the first time it is needed, reading it from the cache
+ * when it is fresh and writing it otherwise.
+ */
+void
+path_index_init(void)
+{
+	guint		 i;
+	char		*fn;
+	const char	*path;
+	int64_t		*mtimes;
+	struct stat	 sb;
+
+	if (commands)
+		return;
+
+	if ((path = getenv("PATH")) == NULL || !*path)
+		path = "/usr/bin:/bin";
+
+	dirs = g_strsplit(path, ":", -1);
+	for (ndirs = 0; dirs[ndirs]; ndirs++)
+		if (!*dirs[ndirs]) {
+			g_free(dirs[ndirs]);
+			dirs[ndirs] = g_strdup(".");
+		}
+
+	if ((mtimes = calloc(ndirs, sizeof(int64_t))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < ndirs; i++)
+		mtimes[i] = stat(dirs[i], &sb) < 0 ? -1 : (int64_t)sb.st_mtime;
+
+	commands = g_hash_table_new(g_str_hash, g_str_equal);
+	fn = path_index_file(path);
+
+	if (!path_index_load(fn, path, mtimes)) {
+		g_hash_table_remove_all(commands);
+		path_index_list(mtimes);
+		path_index_save(fn, path, mtimes);
+	}
+
+	g_free(fn);
+	free(mtimes);
+}
+
+/*
+ * The index file for this $PATH: an FNV-1a hash of it, in the cache directory.
+ */
+char *
+path_index_file(const char *path)
+{
+	char		*cdir, *base, *fn;
+	uint32_t	 h = 2166136261u;
+
+	for (; *path; path++) {
+		h ^= (unsigned char)*path;
+		h *= 16777619u;
+	}
+
+	cdir = cache_dir();
+	base = g_strdup_printf("path-%08x", h);
+	fn = g_build_filename(cdir, base, NULL);
+	g_free(base);
+	g_free(cdir);
+
+	return fn;
+}
+
+/*
+ * Fill the index from the cache file. Returns 0 if it is missing, malformed,
+ * untrusted, or written for a different $PATH or older directories.
+ */
+int
+path_index_load(const char *fn, const char *path, int64_t *mtimes)
+{
+	int				 fd;
+	gsize				 len, off;
+	ssize_t				 n = 0;
+	uint32_t			 dir;
+	const char			*p, *end, *nul;
+	struct stat			 sb;
+	struct path_index_header	 hdr;
+
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return 0;
+	if (fstat(fd, &sb) < 0 || !cache_trusted(&sb, fn)) {
+		close(fd);
+		return 0;
+	}
+
+	len = sb.st_size;
+	contents = g_malloc(len + 1);
+	for (off = 0; off < len; off += n)
+		if ((n = read(fd, contents + off, len - off)) <= 0)
+			break;
+	close(fd);
+	if (off < len)
+		goto bad;
+
+	end = contents + len;
+	if (len < sizeof(hdr))
+		goto bad;
+	memcpy(&hdr, contents, sizeof(hdr));
+	if (hdr.magic != PATH_INDEX_MAGIC ||
+	    hdr.version != PATH_INDEX_VERSION || hdr.ndirs != ndirs ||
+	    hdr.len_path != strlen(path) + 1 ||
+	    len < sizeof(hdr) + hdr.len_path + ndirs * sizeof(int64_t))
+		goto bad;
+
+	p = contents + sizeof(hdr);
+	if (memcmp(p, path, hdr.len_path) != 0)
+		goto bad;
+	p += hdr.len_path;
+	if (memcmp(p, mtimes, ndirs * sizeof(int64_t)) != 0)
+		goto bad;
+	p += ndirs * sizeof(int64_t);
+
+	while (p < end) {
+		if (end - p <= (ptrdiff_t)sizeof(uint32_t))
+			goto bad;
+		memcpy(&dir, p, sizeof(uint32_t));
+		p += sizeof(uint32_t);
+		if (dir >= ndirs || (nul = memchr(p, '\0', end - p)) == NULL)
+			goto bad;
+		g_hash_table_insert(commands, (gpointer)p,
+		    GUINT_TO_POINTER(dir + 1));
+		p = nul + 1;
+	}
+
+	return 1;
+
+bad:
+	g_free(contents);
+	contents = NULL;
+	return 0;
+}
+
+/*
+ * Fill the index from the directory listings. Earlier directories win, as
+ * they do for execvp(3).
+ */
+void
+path_index_list(int64_t *mtimes)
+{
+	DIR		*dirp;
+	guint		 i;
+	struct dirent	*dp;
+
+	names = g_string_chunk_new(4096);
+
+	for (i = 0; i < ndirs; i++) {
+		if (mtimes[i] < 0 || (dirp = opendir(dirs[i])) == NULL)
+			continue;
+
+		while ((dp = readdir(dirp)) != NULL) {
+			if (dp->d_name[0] == '.' || dp->d_type == DT_DIR ||
+			    g_hash_table_contains(commands, dp->d_name))
+				continue;
+
+			g_hash_table_insert(commands,
+			    g_string_chunk_insert(names, dp->d_name),
+			    GUINT_TO_POINTER(i + 1));
+		}
+
+		closedir(dirp);
+	}
+}
+
+/*
+ * Write the index to the cache file, unless a directory changed so recently
+ * that it could change again unnoticed within the same second.
+ */
+void
+path_index_save(const char *fn, const char *path, int64_t *mtimes)
+{
+	int				 fd, failed;
+	guint				 i;
+	char				*cdir, *tmp;
+	FILE				*fp;
+	uint32_t			 n;
+	gpointer			 name, dir;
+	GHashTableIter			 iter;
+	struct path_index_header	 hdr;
+
+	for (i = 0; i < ndirs; i++)
+		if (mtimes[i] >= time(NULL))
+			return;
+
+	cdir = cache_dir();
+	if (g_mkdir_with_parents(cdir, 0755) < 0) {
+		g_free(cdir);
+		return;
+	}
+	g_free(cdir);
+
+	tmp = g_strdup_printf("%s.XXXXXX", fn);
+	if ((fd = mkstemp(tmp)) < 0) {
+		warn("mkstemp: %s", tmp);
+		goto done;
+	}
+	fchmod(fd, 0644);
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		warn("fdopen");
+		close(fd);
+		unlink(tmp);
+		goto done;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PATH_INDEX_MAGIC;
+	hdr.version = PATH_INDEX_VERSION;
+	hdr.ndirs = ndirs;
+	hdr.len_path = strlen(path) + 1;
+	fwrite(&hdr, sizeof(hdr), 1, fp);
+	fwrite(path, 1, hdr.len_path, fp);
+	fwrite(mtimes, sizeof(int64_t), ndirs, fp);
+
+	g_hash_table_iter_init(&iter, commands);
+	while (g_hash_table_iter_next(&iter, &name, &dir)) {
+		n = GPOINTER_TO_UINT(dir) - 1;
+		fwrite(&n, sizeof(uint32_t), 1, fp);
+		fputs(name, fp);
+		putc('\0', fp);
+	}
+
+	failed = ferror(fp);
+	if (fclose(fp) != 0 || failed) {
+		warnx("could not write %s", tmp);
+		unlink(tmp);
+	} else if (rename(tmp, fn) < 0) {
+		warn("rename: %s", fn);
+		unlink(tmp);
+	}
+
+done:
+	g_free(tmp);
+}
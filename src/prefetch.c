@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Read the files that collecting the desktop entries will need in a thread of
+ * its own, so that the disk or network is busy while GTK initializes. Only the
+ * page cache is warmed; nothing read here is used directly.
+ *
+ * Like the scan, this skips desktop files whose ID an earlier directory has,
+ * since those are never parsed.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "prefetch.h"
+#include "compat.h"
+
+static void	 prefetch_add(GPtrArray *, const char *);
+static gpointer	 prefetch_run(gpointer);
+static GPtrArray	*prefetch_list(const char *);
+static void	 prefetch_dir(const char *, GPtrArray *, GHashTable *);
+static void	 prefetch_file(const char *);
+
+/*
+ * Start reading ahead. The cache file names depend on the locale, so this
+ * must be called after setlocale(3).
+ */
+void
+prefetch_start(void)
+{
+	GPtrArray		*dirs;
+	const gchar *const	*data_dirs;
+
+	dirs = g_ptr_array_new();
+
+	prefetch_add(dirs, g_get_user_data_dir());
+	for (data_dirs = g_get_system_data_dirs(); *data_dirs; data_dirs++)
+		prefetch_add(dirs, *data_dirs);
+
+	g_thread_unref(g_thread_new("prefetch", prefetch_run, dirs));
+}
+
+/*
+ * Add an applications directory and its cache file to the list.
+ */
+void
+prefetch_add(GPtrArray *dirs, const char *data_dir)
+{
+	char	*dir;
+
+	dir = g_build_filename(data_dir, "applications", NULL);
+	g_ptr_array_add(dirs, dir);
+	g_ptr_array_add(dirs, cache_file(dir));
+}
+
+/*
+ * The thread: for each directory, read its cache if that is fresh, and
+ * otherwise those of its desktop files that no earlier directory shadows.
+ */
+gpointer
+prefetch_run(gpointer data)
+{
+	guint		 i, j;
+	GPtrArray	*dirs = data, *names;
+	GHashTable	*seen;
+
+	seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+	for (i = 0; i + 1 < dirs->len; i += 2) {
+		if ((names = prefetch_list(g_ptr_array_index(dirs, i))) == NULL)
+			continue;
+
+		if (cache_is_fresh(g_ptr_array_index(dirs, i + 1),
+		    g_ptr_array_index(dirs, i)))
+			prefetch_file(g_ptr_array_index(dirs, i + 1));
+		else
+			prefetch_dir(g_ptr_array_index(dirs, i), names, seen);
+
+		/* The IDs pass to the set, shadowing later directories. */
+		for (j = 0; j < names->len; j++)
+			g_hash_table_add(seen, g_ptr_array_index(names, j));
+		g_ptr_array_free(names, TRUE);
+	}
+
+	g_hash_table_unref(seen);
+	for (i = 0; i < dirs->len; i++)
+		g_free(g_ptr_array_index(dirs, i));
+	g_ptr_array_free(dirs, TRUE);
+
+	return NULL;
+}
+
+/*
+ * The desktop file IDs in the directory, or NULL if it cannot be read.
+ */
+GPtrArray *
+prefetch_list(const char *dir)
+{
+	DIR		*dirp;
+	size_t		 len_name;
+	GPtrArray	*names;
+	struct dirent	*dp;
+
+	if ((dirp = opendir(dir)) == NULL)
+		return NULL;
+
+	names = g_ptr_array_new();
+	while ((dp = readdir(dirp)) != NULL) {
+		len_name = strlen(dp->d_name);
+		if (len_name > 8 &&
+		    strcmp(dp->d_name + len_name - 8, ".desktop") == 0)
+			g_ptr_array_add(names, g_strdup(dp->d_name));
+	}
+
+	closedir(dirp);
+	return names;
+}
+
+/*
+ * Read the desktop files of the directory by ID, other than those already
+ * seen in an earlier directory.
+ */
+void
+prefetch_dir(const char *dir, GPtrArray *names, GHashTable *seen)
+{
+	guint		 i;
+	char		*fn;
+	const char	*id;
+
+	for (i = 0; i < names->len; i++) {
+		id = g_ptr_array_index(names, i);
+		if (g_hash_table_contains(seen, id))
+			continue;
+
+		fn = g_build_filename(dir, id, NULL);
+		prefetch_file(fn);
+		g_free(fn);
+	}
+}
+
+/*
+ * Read the file into the page cache. Reading it outright, rather than asking
+ * for readahead, also works over NFS and on systems without
+ * posix_fadvise(2).
+ */
+void
+prefetch_file(const char *fn)
+{
+	int	fd;
+	char	buf[16384];
+
+	if ((fd = open(fn, O_RDONLY)) < 0)
+		return;
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+
+	close(fd);
+}
@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Warm the page cache for the program that is likely to be run next: the
+ * executable named by the Exec of the selected entry, and the shared
+ * libraries it needs directly. Hints are only acted on once the selection has
+ * stayed put for a moment, and each file is read ahead once per session. The
+ * reading happens in one background thread, which gives up on a program as
+ * soon as the selection moves on.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <elf.h>
+#include <err.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+#include "pathindex.h"
+#include "readahead.h"
+#include "compat.h"
+
+#define READAHEAD_DELAY	150	/* Milliseconds the selection must stay */
+#define READAHEAD_CHUNK	(1 << 16)
+
+#if UINTPTR_MAX > 0xffffffffu
+#define READAHEAD_CLASS	ELFCLASS64
+typedef Elf64_Ehdr	ra_ehdr;
+typedef Elf64_Shdr	ra_shdr;
+typedef Elf64_Dyn	ra_dyn;
+#else
+#define READAHEAD_CLASS	ELFCLASS32
+typedef Elf32_Ehdr	ra_ehdr;
+typedef Elf32_Shdr	ra_shdr;
+typedef Elf32_Dyn	ra_dyn;
+#endif
+
+struct readahead_job {
+	gint	 generation;	/* The hint this is for */
+	char	*path;		/* The resolved executable */
+};
+
+static gboolean	 readahead_fire(gpointer);
+static void	 readahead_run(gpointer, gpointer);
+static int	 readahead_current(const struct readahead_job *);
+static int	 readahead_file(const char *);
+static GPtrArray *readahead_needed(const char *, GPtrArray **);
+static GPtrArray *readahead_split(const char *);
+static char	*readahead_find_lib(const char *, GPtrArray *);
+static GPtrArray *readahead_lib_dirs(void);
+static void	 readahead_ld_conf(GPtrArray *, const char *, int);
+
+static gint		 generation = 0;	/* Bumped by every hint */
+static guint		 timer = 0;		/* The pending hint */
+static char		*pending = NULL;	/* Its Exec */
+static GThreadPool	*pool = NULL;
+
+/* Only used from the pool's thread. */
+static GHashTable	*warmed = NULL;		/* Files already read ahead */
+static GPtrArray	*lib_dirs = NULL;	/* Default library directories */
+
+/*
+ * The selection is now on an entry with this Exec, or on nothing if NULL.
+ * Whatever was being read ahead for the previous selection is abandoned.
+ */
+void
+readahead_hint(const char *exec)
+{
+	g_atomic_int_inc(&generation);
+
+	if (timer) {
+		g_source_remove(timer);
+		timer = 0;
+	}
+	g_free(pending);
+	pending = NULL;
+
+	if (exec == NULL)
+		return;
+
+	pending = g_strdup(exec);
+	timer = g_timeout_add(READAHEAD_DELAY, readahead_fire, NULL);
+}
+
+/*
+ * The selection has settled: resolve the executable, here where the PATH
+ * index lives, and hand it to the thread.
+ */
+gboolean
+readahead_fire(gpointer user_data)
+{
+	gchar			**argv;
+	char			*path;
+	struct readahead_job	*job;
+
+	timer = 0;
+
+	if (!g_shell_parse_argv(pending, NULL, &argv, NULL))
+		return G_SOURCE_REMOVE;
+	path = path_index_resolve(argv[0]);
+	g_strfreev(argv);
+	if (path == NULL)
+		return G_SOURCE_REMOVE;
+
+	if (pool == NULL)
+		pool = g_thread_pool_new(readahead_run, NULL, 1, FALSE, NULL);
+
+	if ((job = malloc(sizeof(struct readahead_job))) == NULL)
+		err(1, NULL);
+	job->generation = g_atomic_int_get(&generation);
+	job->path = path;
+	g_thread_pool_push(pool, job, NULL);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Read ahead the executable and then its libraries, stopping if a newer hint
+ * comes along.
+ */
+void
+readahead_run(gpointer data, gpointer user_data)
+{
+	guint			 i;
+	char			*lib;
+	GPtrArray		*needed, *runpath = NULL;
+	struct readahead_job	*job;
+
+	job = data;
+
+	if (warmed == NULL)
+		warmed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+		    NULL);
+
+	if (!readahead_current(job) || !readahead_file(job->path))
+		goto done;
+
+	if ((needed = readahead_needed(job->path, &runpath)) == NULL)
+		goto done;
+
+	for (i = 0; i < needed->len && readahead_current(job); i++) {
+		lib = readahead_find_lib(g_ptr_array_index(needed, i), runpath);
+		if (lib)
+			readahead_file(lib);
+		g_free(lib);
+	}
+
+	g_ptr_array_free(needed, TRUE);
+	if (runpath)
+		g_ptr_array_free(runpath, TRUE);
+
+done:
+	g_free(job->path);
+	free(job);
+}
+
+/*
+ * Whether the job is still for the current selection.
+ */
+int
+readahead_current(const struct readahead_job *job)
+{
+	return job->generation == g_atomic_int_get(&generation);
+}
+
+/*
+ * Ask for the whole file to be read into the page cache, unless it has been
+ * already. Returns 0 if it cannot be opened.
+ */
+int
+readahead_file(const char *path)
+{
+	int	 fd;
+#ifndef HAVE_POSIX_FADVISE
+	char	 buf[READAHEAD_CHUNK];
+#endif
+
+	if (g_hash_table_contains(warmed, path))
+		return 1;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return 0;
+
+#ifdef HAVE_POSIX_FADVISE
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+#else
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+#endif
+
+	close(fd);
+	g_hash_table_add(warmed, g_strdup(path));
+	return 1;
+}
+
+/*
+ * The DT_NEEDED names of an ELF file of the native class, and its
+ * DT_RUNPATH or DT_RPATH directories in runpath. Returns NULL if it is not
+ * such a file, such as when it is a script.
+ */
+GPtrArray *
+readahead_needed(const char *path, GPtrArray **runpath)
+{
+	int		 fd;
+	char		*map;
+	size_t		 len, i, j, n;
+	struct stat	 sb;
+	ra_ehdr		*eh;
+	ra_shdr		*sh, *str;
+	ra_dyn		*dyn;
+	GPtrArray	*needed = NULL;
+	const char	*s;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return NULL;
+	if (fstat(fd, &sb) < 0 || (size_t)sb.st_size < sizeof(ra_ehdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	len = sb.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return NULL;
+
+	eh = (ra_ehdr *)map;
+	if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+	    eh->e_ident[EI_CLASS] != READAHEAD_CLASS ||
+	    eh->e_shentsize != sizeof(ra_shdr) ||
+	    eh->e_shoff > len ||
+	    (size_t)eh->e_shnum > (len - eh->e_shoff) / sizeof(ra_shdr))
+		goto done;
+
+	sh = (ra_shdr *)(map + eh->e_shoff);
+	for (i = 0; i < eh->e_shnum; i++) {
+		if (sh[i].sh_type != SHT_DYNAMIC || sh[i].sh_link >= eh->e_shnum)
+			continue;
+
+		str = &sh[sh[i].sh_link];
+		if (sh[i].sh_offset > len ||
+		    sh[i].sh_size > len - sh[i].sh_offset ||
+		    str->sh_offset > len || str->sh_size > len - str->sh_offset ||
+		    str->sh_size == 0 || map[str->sh_offset + str->sh_size - 1])
+			continue;
+
+		needed = g_ptr_array_new_with_free_func(g_free);
+		dyn = (ra_dyn *)(map + sh[i].sh_offset);
+		n = sh[i].sh_size / sizeof(ra_dyn);
+		for (j = 0; j < n && dyn[j].d_tag != DT_NULL; j++) {
+			if (dyn[j].d_un.d_val >= str->sh_size)
+				continue;
+			s = map + str->sh_offset + dyn[j].d_un.d_val;
+
+			if (dyn[j].d_tag == DT_NEEDED)
+				g_ptr_array_add(needed, g_strdup(s));
+			else if ((dyn[j].d_tag == DT_RUNPATH ||
+			    dyn[j].d_tag == DT_RPATH) && *runpath == NULL)
+				*runpath = readahead_split(s);
+		}
+		break;
+	}
+
+done:
+	munmap(map, len);
+	return needed;
+}
+
+/*
+ * The directories in a colon-separated list. Those that need expanding, such
+ * as $ORIGIN, are left out.
+ */
+GPtrArray *
+readahead_split(const char *list)
+{
+	gchar		**dirs, **dir;
+	GPtrArray	 *a;
+
+	a = g_ptr_array_new_with_free_func(g_free);
+	dirs = g_strsplit(list, ":", -1);
+	for (dir = dirs; *dir; dir++)
+		if (**dir == '/' && strchr(*dir, '$') == NULL)
+			g_ptr_array_add(a, g_strdup(*dir));
+	g_strfreev(dirs);
+
+	return a;
+}
+
+/*
+ * Find a library as the dynamic linker would: in the run path, then in
+ * $LD_LIBRARY_PATH, then in the default directories.
+ */
+char *
+readahead_find_lib(const char *name, GPtrArray *runpath)
+{
+	guint		 i, j;
+	char		*path;
+	const char	*env;
+	GPtrArray	*dirs[3] = { NULL, NULL, NULL };
+
+	if (strchr(name, '/'))
+		return g_strdup(name);
+
+	if (lib_dirs == NULL)
+		lib_dirs = readahead_lib_dirs();
+
+	dirs[0] = runpath;
+	if ((env = getenv("LD_LIBRARY_PATH")) != NULL)
+		dirs[1] = readahead_split(env);
+	dirs[2] = lib_dirs;
+
+	path = NULL;
+	for (i = 0; i < G_N_ELEMENTS(dirs) && path == NULL; i++)
+		for (j = 0; dirs[i] && j < dirs[i]->len && path == NULL; j++) {
+			path = g_build_filename(g_ptr_array_index(dirs[i], j),
+			    name, NULL);
+			if (access(path, R_OK) < 0) {
+				g_free(path);
+				path = NULL;
+			}
+		}
+
+	if (dirs[1])
+		g_ptr_array_free(dirs[1], TRUE);
+	return path;
+}
+
+/*
+ * The directories listed in /etc/ld.so.conf, followed by the usual ones.
+ */
+GPtrArray *
+readahead_lib_dirs(void)
+{
+	GPtrArray	*dirs;
+
+	dirs = g_ptr_array_new_with_free_func(g_free);
+	readahead_ld_conf(dirs, "/etc/ld.so.conf", 0);
+	g_ptr_array_add(dirs, g_strdup("/lib"));
+	g_ptr_array_add(dirs, g_strdup("/usr/lib"));
+	g_ptr_array_add(dirs, g_strdup("/lib64"));
+	g_ptr_array_add(dirs, g_strdup("/usr/lib64"));
+	g_ptr_array_add(dirs, g_strdup("/usr/local/lib"));
+	g_ptr_array_add(dirs, g_strdup("/usr/X11R6/lib"));
+
+	return dirs;
+}
+
+/*
+ * Add the directories in an ld.so.conf(5), following its includes a few
+ * levels deep.
+ */
+void
+readahead_ld_conf(GPtrArray *dirs, const char *fn, int depth)
+{
+	FILE	*fp;
+	char	*line = NULL, *p;
+	size_t	 size = 0, i;
+	glob_t	 g;
+
+	if (depth > 4 || (fp = fopen(fn, "r")) == NULL)
+		return;
+
+	while (getline(&line, &size, fp) != -1) {
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		p = g_strstrip(line);
+
+		if (strncmp(p, "include", 7) == 0 &&
+		    g_ascii_isspace(p[7])) {
+			p = g_strstrip(p + 8);
+			if (glob(p, 0, NULL, &g) == 0) {
+				for (i = 0; i < g.gl_pathc; i++)
+					readahead_ld_conf(dirs, g.gl_pathv[i],
+					    depth + 1);
+				globfree(&g);
+			}
+		} else if (*p == '/')
+			g_ptr_array_add(dirs, g_strdup(p));
+	}
+
+	free(line);
+	fclose(fp);
+}
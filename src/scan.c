@@ -0,0 +1,692 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Read the applications directories, each in a thread of its own, so that a
+ * slow or hung file system holds up only its own directory. The caller waits
+ * for each directory until a deadline, and is told from the main loop when
+ * one that missed it finishes after all.
+ *
+ * A directory lists its desktop file IDs before parsing anything, then waits
+ * briefly for the directories ahead of it to list theirs, so that the files
+ * they shadow are not read. The prefetch thread skips the same files; only a
+ * directory ahead that does not list its IDs in time lets them be read.
+ *
+ * The entries point into the directory's cache, which stays mapped as long as
+ * the scan lives, so their strings take no heap and the fields that are
+ * rarely used are only paged in when they are. Only when the cache cannot be
+ * written are the strings copied.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <err.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "cache.h"
+#include "desktop.h"
+#include "scan.h"
+#include "compat.h"
+
+#define SCAN_LIST_WAIT	(100 * G_TIME_SPAN_MILLISECOND)
+
+struct scan_dir {
+	struct scan	*scan;
+	guint		 prio;		/* Its place in the search order */
+	char		*path;		/* The applications directory */
+	GHashTable	*ids;		/* Its desktop file IDs, once listed */
+	struct cache	*cache;		/* The cache that the entries point into */
+	GStringChunk	*strings;	/* Their strings, if there is no cache */
+	GArray		*entries;	/* Its entries, once done */
+	struct cache	*stale;		/* Its cache as it was, if used */
+	GArray		*stale_entries;	/* The entries in that */
+	int		 listed;
+	int		 done;
+	int		 cached;	/* Whether it was read from the cache */
+	guint		 failures;	/* Desktop files that could not be read */
+	scan_late_func	 late;		/* Called from the main loop when done */
+	gpointer	 late_data;
+};
+
+struct scan {
+	GMutex		 lock;		/* Guards listed, done, and late */
+	GCond		 cond;		/* Signalled when those change */
+	gint		 refs;		/* The caller, threads, and idle calls */
+	gint64		 list_deadline;	/* When to stop waiting for listings */
+	guint		 len;
+	struct scan_dir	*dirs;
+};
+
+static gpointer		 scan_run(gpointer);
+static GPtrArray	*scan_list(const char *);
+static GPtrArray	*scan_ahead(struct scan_dir *, GPtrArray *);
+static int		 scan_shadowed(GPtrArray *, const char *);
+static int		 scan_shadows_hold(struct cache *, GPtrArray *);
+static void		 scan_file(struct scan_dir *, const char *,
+    struct cache_writer *);
+static char		*scan_locale_string(GKeyFile *, const char *);
+static void		 scan_add(struct scan_dir *, const struct entry *);
+static void		 scan_add_cached(GArray *, struct cache *);
+static const char	*scan_string(struct scan_dir *, const char *);
+static void		 scan_finish(struct scan_dir *);
+static gboolean		 scan_idle(gpointer);
+
+/*
+ * Start reading the NULL-terminated list of applications directories, in
+ * order of precedence.
+ */
+struct scan *
+scan_start(char **dirs)
+{
+	guint		 i;
+	struct scan	*scan;
+
+	if ((scan = calloc(1, sizeof(struct scan))) == NULL)
+		err(1, NULL);
+
+	scan->len = g_strv_length(dirs);
+	if ((scan->dirs = calloc(scan->len, sizeof(struct scan_dir))) == NULL)
+		err(1, NULL);
+
+	g_mutex_init(&scan->lock);
+	g_cond_init(&scan->cond);
+	scan->refs = 1 + scan->len;
+	scan->list_deadline = g_get_monotonic_time() + SCAN_LIST_WAIT;
+
+	for (i = 0; i < scan->len; i++) {
+		scan->dirs[i].scan = scan;
+		scan->dirs[i].prio = i;
+		scan->dirs[i].path = g_strdup(dirs[i]);
+		scan->dirs[i].strings = g_string_chunk_new(4096);
+		scan->dirs[i].entries = g_array_new(FALSE, TRUE,
+		    sizeof(struct entry));
+	}
+
+	for (i = 0; i < scan->len; i++)
+		g_thread_unref(g_thread_new("scan", scan_run, &scan->dirs[i]));
+
+	return scan;
+}
+
+/*
+ * Let go of the scan. Threads that are still reading keep it alive.
+ */
+void
+scan_unref(struct scan *scan)
+{
+	guint	i;
+
+	if (scan == NULL || !g_atomic_int_dec_and_test(&scan->refs))
+		return;
+
+	for (i = 0; i < scan->len; i++) {
+		g_free(scan->dirs[i].path);
+		if (scan->dirs[i].ids)
+			g_hash_table_unref(scan->dirs[i].ids);
+		cache_close(scan->dirs[i].cache);
+		g_string_chunk_free(scan->dirs[i].strings);
+		g_array_free(scan->dirs[i].entries, TRUE);
+		cache_close(scan->dirs[i].stale);
+		if (scan->dirs[i].stale_entries)
+			g_array_free(scan->dirs[i].stale_entries, TRUE);
+	}
+
+	g_mutex_clear(&scan->lock);
+	g_cond_clear(&scan->cond);
+	free(scan->dirs);
+	free(scan);
+}
+
+/*
+ * The number of directories.
+ */
+guint
+scan_len(struct scan *scan)
+{
+	return scan->len;
+}
+
+/*
+ * The path of a directory.
+ */
+const char *
+scan_dir(struct scan *scan, guint i)
+{
+	return scan->dirs[i].path;
+}
+
+/*
+ * Wait for a directory to be read, until the deadline on the monotonic clock.
+ * Returns 1 if it was.
+ */
+int
+scan_wait(struct scan *scan, guint i, gint64 deadline)
+{
+	int	done;
+
+	g_mutex_lock(&scan->lock);
+	while (!scan->dirs[i].done)
+		if (!g_cond_wait_until(&scan->cond, &scan->lock, deadline))
+			break;
+	done = scan->dirs[i].done;
+	g_mutex_unlock(&scan->lock);
+
+	return done;
+}
+
+/*
+ * Whether a directory that has been read came from its cache.
+ */
+int
+scan_cached(struct scan *scan, guint i)
+{
+	return scan->dirs[i].cached;
+}
+
+/*
+ * The number of desktop files in a directory that has been read that could not
+ * be parsed.
+ */
+guint
+scan_failures(struct scan *scan, guint i)
+{
+	return scan->dirs[i].failures;
+}
+
+/*
+ * The struct entry array of a directory that has been read. The entries are
+ * valid as long as the scan is.
+ */
+GArray *
+scan_entries(struct scan *scan, guint i)
+{
+	return scan->dirs[i].entries;
+}
+
+/*
+ * The entries of the directory as last cached, for when it has not been read
+ * in time. This does not look at the directory itself. Only to be used from
+ * the main thread.
+ */
+GArray *
+scan_stale_entries(struct scan *scan, guint i)
+{
+	struct scan_dir	*sd;
+
+	sd = &scan->dirs[i];
+	if (sd->stale_entries == NULL) {
+		sd->stale_entries = g_array_new(FALSE, TRUE,
+		    sizeof(struct entry));
+		if ((sd->stale = cache_open_stale(sd->path)) != NULL)
+			scan_add_cached(sd->stale_entries, sd->stale);
+	}
+
+	return sd->stale_entries;
+}
+
+/*
+ * Call the function from the main loop once the directory has been read,
+ * which may be straight away.
+ */
+void
+scan_notify(struct scan *scan, guint i, scan_late_func late, gpointer data)
+{
+	struct scan_dir	*sd;
+
+	sd = &scan->dirs[i];
+
+	g_mutex_lock(&scan->lock);
+	sd->late = late;
+	sd->late_data = data;
+	if (sd->done) {
+		g_atomic_int_inc(&scan->refs);
+		g_idle_add(scan_idle, sd);
+	}
+	g_mutex_unlock(&scan->lock);
+}
+
+/*
+ * Read one directory: from its cache if that is fresh and everything it left
+ * unread is still shadowed, and otherwise from its desktop files.
+ */
+gpointer
+scan_run(gpointer data)
+{
+	guint			 i;
+	char			*fn;
+	const char		*id;
+	struct entry		 e;
+	struct scan_dir		*sd;
+	struct cache		*cache;
+	struct cache_writer	*cw;
+	GPtrArray		*names = NULL, *ahead;
+
+	sd = data;
+
+	if ((cache = cache_open(sd->path)) != NULL) {
+		names = g_ptr_array_new_with_free_func(g_free);
+		while (cache_next(cache, &e))
+			g_ptr_array_add(names, g_strdup(entry_id(&e)));
+		cache_rewind(cache);
+	} else
+		names = scan_list(sd->path);
+
+	ahead = scan_ahead(sd, names);
+
+	if (cache && !scan_shadows_hold(cache, ahead)) {
+		cache_close(cache);
+		cache = NULL;
+	}
+
+	if (cache) {
+		scan_add_cached(sd->entries, cache);
+		sd->cache = cache;
+		sd->cached = 1;
+		goto done;
+	}
+
+	if (names == NULL)
+		goto done;
+
+	cw = cache_writer_new(sd->path);
+	for (i = 0; i < names->len; i++) {
+		id = g_ptr_array_index(names, i);
+		fn = g_build_filename(sd->path, id, NULL);
+
+		/* An earlier directory has a file by this ID; never read it. */
+		if (scan_shadowed(ahead, id)) {
+			memset(&e, 0, sizeof(e));
+			e.name = "";
+			e.file = fn;
+			e.shadowed = 1;
+			cache_writer_add(cw, &e, NULL);
+		} else
+			scan_file(sd, fn, cw);
+
+		g_free(fn);
+	}
+	cache_writer_commit(cw);
+
+	/* Trade the copies for the cache that was just written. */
+	if ((cache = cache_open(sd->path)) != NULL) {
+		g_array_set_size(sd->entries, 0);
+		g_string_chunk_clear(sd->strings);
+		scan_add_cached(sd->entries, cache);
+		sd->cache = cache;
+	}
+
+done:
+	if (names)
+		g_ptr_array_free(names, TRUE);
+	g_ptr_array_free(ahead, TRUE);
+	scan_finish(sd);
+	return NULL;
+}
+
+/*
+ * The desktop file names in the directory, or NULL if it cannot be read.
+ */
+GPtrArray *
+scan_list(const char *path)
+{
+	DIR		*dirp;
+	size_t		 len;
+	GPtrArray	*names;
+	struct dirent	*dp;
+
+	if ((dirp = opendir(path)) == NULL)
+		return NULL;
+
+	names = g_ptr_array_new_with_free_func(g_free);
+	while ((dp = readdir(dirp)) != NULL) {
+		len = strlen(dp->d_name);
+		if (len > 8 && strcmp(dp->d_name + len - 8, ".desktop") == 0)
+			g_ptr_array_add(names, g_strdup(dp->d_name));
+	}
+
+	if (closedir(dirp) < 0)
+		warn("closedir: %s", path);
+
+	return names;
+}
+
+/*
+ * Publish this directory's IDs, then wait a little for the directories ahead
+ * of it to do the same. Returns the ID sets of those that did.
+ */
+GPtrArray *
+scan_ahead(struct scan_dir *sd, GPtrArray *names)
+{
+	guint		 i;
+	struct scan	*scan;
+	GPtrArray	*ahead;
+	GHashTable	*ids;
+
+	scan = sd->scan;
+	ahead = g_ptr_array_new();
+
+	ids = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	for (i = 0; names && i < names->len; i++)
+		g_hash_table_add(ids, g_strdup(g_ptr_array_index(names, i)));
+
+	g_mutex_lock(&scan->lock);
+
+	sd->ids = ids;
+	sd->listed = 1;
+	g_cond_broadcast(&scan->cond);
+
+	for (i = 0; i < sd->prio; i++)
+		while (!scan->dirs[i].listed)
+			if (!g_cond_wait_until(&scan->cond, &scan->lock,
+			    scan->list_deadline))
+				goto unlock;
+unlock:
+	/* The sets do not change once listed. */
+	for (i = 0; i < sd->prio; i++)
+		if (scan->dirs[i].listed)
+			g_ptr_array_add(ahead, scan->dirs[i].ids);
+
+	g_mutex_unlock(&scan->lock);
+	return ahead;
+}
+
+/*
+ * Whether a directory ahead has a file by this ID.
+ */
+int
+scan_shadowed(GPtrArray *ahead, const char *id)
+{
+	guint	i;
+
+	for (i = 0; i < ahead->len; i++)
+		if (g_hash_table_contains(g_ptr_array_index(ahead, i), id))
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Whether every file that was shadowed when the cache was written is still
+ * shadowed. Those files were never parsed, so the cache is of no use once one
+ * of them comes out from under its shadow.
+ */
+int
+scan_shadows_hold(struct cache *cache, GPtrArray *ahead)
+{
+	int		ret = 1;
+	struct entry	e;
+
+	while (cache_next(cache, &e))
+		if (e.shadowed && !scan_shadowed(ahead, entry_id(&e))) {
+			ret = 0;
+			break;
+		}
+
+	cache_rewind(cache);
+	return ret;
+}
+
+/*
+ * Parse one desktop file into the directory's entries and its cache. A file
+ * that cannot be read, or that has no name, is warned about and only shadows
+ * later files by its ID.
+ */
+void
+scan_file(struct scan_dir *sd, const char *fn, struct cache_writer *cw)
+{
+	char		*name_v = NULL, *exec_v = NULL, *icon_v = NULL;
+	char		*collate_v = NULL, *generic_v = NULL;
+	char		*keywords_v = NULL, *comment_v = NULL;
+	char		*tryexec_v = NULL, *only_other_v = NULL;
+	char		*not_other_v = NULL, *wmclass_v = NULL, **list_v;
+	char		*mimetypes_v = NULL;
+	struct entry	 e;
+	struct stat	 sb, *sbp = NULL;
+	GKeyFile	*key_file;
+	GError		*error = NULL;
+	gboolean	 nodisplay_v, hidden_v;
+
+	memset(&e, 0, sizeof(e));
+	e.name = "";
+	e.file = fn;
+
+	/* Taken before reading, so that a later edit is never missed. */
+	if (stat(fn, &sb) == 0)
+		sbp = &sb;
+
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_file(key_file, fn, G_KEY_FILE_NONE, &error)) {
+		warnx("%s: %s", fn, error->message);
+		g_clear_error(&error);
+		sd->failures++;
+		e.hidden = 1;
+		goto insert;
+	}
+
+	nodisplay_v = g_key_file_get_boolean(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_NO_DISPLAY, NULL);
+	if (nodisplay_v != FALSE) {
+		e.hidden = 1;
+		goto insert;
+	}
+
+	name_v = g_key_file_get_locale_string(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_NAME,
+	    NULL, &error);
+	if (name_v == NULL) {
+		warnx("%s: %s", fn, error->message);
+		g_clear_error(&error);
+		sd->failures++;
+		e.hidden = 1;
+		goto insert;
+	}
+
+	e.name = name_v;
+	e.collate = collate_v = g_utf8_collate_key(name_v, -1);
+
+	hidden_v = g_key_file_get_boolean(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_HIDDEN, NULL);
+	if (hidden_v != FALSE) {
+		e.hidden = 1;
+		goto insert;
+	}
+
+	exec_v = g_key_file_get_locale_string(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC,
+	    NULL, &error);
+	if (exec_v == NULL) {
+		warnx("%s: %s", fn, error->message);
+		g_clear_error(&error);
+		sd->failures++;
+		e.hidden = 1;
+		goto insert;
+	}
+
+	e.exec = exec_v;
+	e.fcodes = field_codes(exec_v);
+
+	icon_v = g_key_file_get_locale_string(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_ICON,
+	    NULL, &error);
+	g_clear_error(&error);
+	e.icon = icon_v;
+
+	e.generic = generic_v = scan_locale_string(key_file,
+	    G_KEY_FILE_DESKTOP_KEY_GENERIC_NAME);
+	e.keywords = keywords_v = scan_locale_string(key_file, "Keywords");
+	e.comment = comment_v = scan_locale_string(key_file,
+	    G_KEY_FILE_DESKTOP_KEY_COMMENT);
+	e.tryexec = tryexec_v = g_key_file_get_string(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_TRY_EXEC,
+	    NULL);
+
+	list_v = g_key_file_get_string_list(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_ONLY_SHOW_IN, NULL, NULL);
+	e.only_in = desktop_mask(list_v, &only_other_v);
+	e.only_in_other = only_other_v;
+	g_strfreev(list_v);
+
+	list_v = g_key_file_get_string_list(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_NOT_SHOW_IN, NULL, NULL);
+	e.not_in = desktop_mask(list_v, &not_other_v);
+	e.not_in_other = not_other_v;
+	g_strfreev(list_v);
+
+	e.use_term = g_key_file_get_boolean(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_TERMINAL, NULL);
+
+	/* The actions themselves are read when the row is expanded. */
+	e.has_actions = g_key_file_has_key(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, "Actions", NULL);
+	e.dbus = g_key_file_get_boolean(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, "DBusActivatable", NULL);
+	e.startup_notify = g_key_file_get_boolean(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_STARTUP_NOTIFY, NULL);
+	e.wmclass = wmclass_v = g_key_file_get_string(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP,
+	    G_KEY_FILE_DESKTOP_KEY_STARTUP_WM_CLASS, NULL);
+	e.mimetypes = mimetypes_v = g_key_file_get_string(key_file,
+	    G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_MIME_TYPE,
+	    NULL);
+
+insert:
+	cache_writer_add(cw, &e, sbp);
+	scan_add(sd, &e);
+
+	g_free(exec_v);
+	g_free(name_v);
+	g_free(icon_v);
+	g_free(collate_v);
+	g_free(generic_v);
+	g_free(keywords_v);
+	g_free(comment_v);
+	g_free(tryexec_v);
+	g_free(only_other_v);
+	g_free(not_other_v);
+	g_free(wmclass_v);
+	g_free(mimetypes_v);
+	g_key_file_free(key_file);
+}
+
+/*
+ * An optional localized string from the desktop entry group, or NULL.
+ */
+char *
+scan_locale_string(GKeyFile *key_file, const char *key)
+{
+	return g_key_file_get_locale_string(key_file, G_KEY_FILE_DESKTOP_GROUP,
+	    key, NULL, NULL);
+}
+
+/*
+ * Keep a copy of the entry, with its strings, until the cache is written.
+ */
+void
+scan_add(struct scan_dir *sd, const struct entry *e)
+{
+	struct entry	c;
+
+	c = *e;
+	c.name = scan_string(sd, e->name);
+	c.exec = scan_string(sd, e->exec);
+	c.icon = scan_string(sd, e->icon);
+	c.collate = scan_string(sd, e->collate);
+	c.generic = scan_string(sd, e->generic);
+	c.keywords = scan_string(sd, e->keywords);
+	c.comment = scan_string(sd, e->comment);
+	c.tryexec = scan_string(sd, e->tryexec);
+	c.only_in_other = scan_string(sd, e->only_in_other);
+	c.not_in_other = scan_string(sd, e->not_in_other);
+	c.file = scan_string(sd, e->file);
+	c.wmclass = scan_string(sd, e->wmclass);
+	c.mimetypes = scan_string(sd, e->mimetypes);
+
+	g_array_append_val(sd->entries, c);
+}
+
+/*
+ * Add the entries in the cache, other than the shadowed ones, without copying
+ * their strings.
+ */
+void
+scan_add_cached(GArray *entries, struct cache *cache)
+{
+	struct entry	e;
+
+	while (cache_next(cache, &e))
+		if (!e.shadowed)
+			g_array_append_val(entries, e);
+}
+
+const char *
+scan_string(struct scan_dir *sd, const char *s)
+{
+	return s ? g_string_chunk_insert(sd->strings, s) : NULL;
+}
+
+/*
+ * Mark the directory as read, and let go of the thread's reference.
+ */
+void
+scan_finish(struct scan_dir *sd)
+{
+	struct scan	*scan;
+
+	scan = sd->scan;
+
+	g_mutex_lock(&scan->lock);
+	sd->done = 1;
+	g_cond_broadcast(&scan->cond);
+	if (sd->late) {
+		g_atomic_int_inc(&scan->refs);
+		g_idle_add(scan_idle, sd);
+	}
+	g_mutex_unlock(&scan->lock);
+
+	scan_unref(scan);
+}
+
+/*
+ * Hand a directory that was read late to the caller, on the main loop.
+ */
+gboolean
+scan_idle(gpointer data)
+{
+	struct scan_dir	*sd;
+
+	sd = data;
+	sd->late(sd->scan, sd->prio, sd->late_data);
+	scan_unref(sd->scan);
+
+	return G_SOURCE_REMOVE;
+}
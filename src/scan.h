@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <glib.h>
+
+#include "entry.h"
+
+struct scan;
+
+typedef void	 (*scan_late_func)(struct scan *, guint, gpointer);
+
+struct scan	*scan_start(char **);
+void		 scan_unref(struct scan *);
+guint		 scan_len(struct scan *);
+const char	*scan_dir(struct scan *, guint);
+int		 scan_wait(struct scan *, guint, gint64);
+int		 scan_cached(struct scan *, guint);
+guint		 scan_failures(struct scan *, guint);
+GArray		*scan_entries(struct scan *, guint);
+GArray		*scan_stale_entries(struct scan *, guint);
+void		 scan_notify(struct scan *, guint, scan_late_func, gpointer);
+
+#endif /* _SCAN_H */
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * An inverted index of case-folded trigrams over the name, generic name,
+ * keywords, and comment of every entry. A query is narrowed to the rows that
+ * contain all of its trigrams by intersecting their posting lists, and only
+ * those rows are compared against the query.
+ *
+ * Rows are only indexed once there is a query, so the generic names, keywords,
+ * and comments are not read at all by those who never search. The rows are
+ * those of the entry store, and the folded text of each is kept back to back
+ * in one blob, like the strings of the store.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <glib.h>
+
+#include "entrystore.h"
+#include "search.h"
+#include "compat.h"
+
+struct search {
+	struct entry_store *store;	/* The rows */
+	guint		 indexed;	/* Rows indexed so far */
+	guint		 changes;	/* Rows replaced when they were */
+	GString		*folded;	/* Folded strings, NUL-terminated */
+	GArray		*names;		/* Offset of the folded name, by row */
+	GArray		*texts;		/* Offset of the folded text, by row */
+	GHashTable	*postings;	/* Trigram to GArray of rows */
+	char		*key;		/* The last query */
+	uint8_t		*hits;		/* Rows matching the last query */
+	guint		 len_hits;
+};
+
+static char	*search_fold(const char *);
+static guint32	 search_intern(struct search *, char *);
+static guint32	 search_trigram(const char *);
+static void	 search_posting_free(gpointer);
+static void	 search_index(struct search *);
+static void	 search_run(struct search *, const char *);
+static GArray	*search_candidates(struct search *, const char *);
+
+/*
+ * An empty index over the rows of the store, which must outlive it.
+ */
+struct search *
+search_new(struct entry_store *store)
+{
+	struct search	*s;
+
+	if ((s = calloc(1, sizeof(struct search))) == NULL)
+		err(1, NULL);
+
+	s->store = store;
+	s->folded = g_string_sized_new(4096);
+	s->names = g_array_new(FALSE, FALSE, sizeof(guint32));
+	s->texts = g_array_new(FALSE, FALSE, sizeof(guint32));
+	s->postings = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+	    NULL, search_posting_free);
+
+	return s;
+}
+
+/*
+ * Free the index.
+ */
+void
+search_free(struct search *s)
+{
+	if (s) {
+		g_string_free(s->folded, TRUE);
+		g_array_free(s->names, TRUE);
+		g_array_free(s->texts, TRUE);
+		g_hash_table_unref(s->postings);
+		g_free(s->key);
+		free(s->hits);
+		free(s);
+	}
+}
+
+void
+search_posting_free(gpointer data)
+{
+	g_array_free(data, TRUE);
+}
+
+/*
+ * Index the rows added since the last query, from their name, generic name,
+ * keywords, and comment. If any row was replaced since, start over, which is
+ * rare enough not to be worth doing row by row.
+ */
+void
+search_index(struct search *s)
+{
+	char			*text, *p;
+	guint			 id, len;
+	guint32			 tri, off;
+	GArray			*posting;
+	const struct entry	*e;
+
+	if (s->changes != entry_store_changes(s->store)) {
+		g_string_truncate(s->folded, 0);
+		g_array_set_size(s->names, 0);
+		g_array_set_size(s->texts, 0);
+		g_hash_table_remove_all(s->postings);
+		s->indexed = 0;
+		s->changes = entry_store_changes(s->store);
+	}
+
+	len = entry_store_len(s->store);
+	for (id = s->indexed; id < len; id++) {
+		e = entry_store_entry(s->store, id);
+
+		text = g_strjoin("\n", e->name, e->generic ? e->generic : "",
+		    e->keywords ? e->keywords : "",
+		    e->comment ? e->comment : "", NULL);
+		off = search_intern(s, search_fold(e->name));
+		g_array_append_val(s->names, off);
+		off = search_intern(s, search_fold(text));
+		g_array_append_val(s->texts, off);
+		g_free(text);
+
+		for (p = s->folded->str + off; p[0] && p[1] && p[2]; p++) {
+			tri = search_trigram(p);
+			posting = g_hash_table_lookup(s->postings,
+			    GUINT_TO_POINTER(tri));
+			if (posting == NULL) {
+				posting = g_array_new(FALSE, FALSE,
+				    sizeof(guint));
+				g_hash_table_insert(s->postings,
+				    GUINT_TO_POINTER(tri), posting);
+			}
+
+			/* Rows are added in order; a repeat is the last. */
+			if (posting->len == 0 || g_array_index(posting, guint,
+			    posting->len - 1) != id)
+				g_array_append_val(posting, id);
+		}
+	}
+
+	s->indexed = len;
+}
+
+/*
+ * Move a folded string onto the end of the blob, returning its offset.
+ */
+guint32
+search_intern(struct search *s, char *folded)
+{
+	guint32	off;
+
+	off = s->folded->len;
+	g_string_append_len(s->folded, folded, strlen(folded) + 1);
+	g_free(folded);
+	return off;
+}
+
+/*
+ * Whether the row matches the query. Rows whose name starts with the query
+ * match; if there are none, rows that contain the query anywhere match.
+ */
+int
+search_matches(struct search *s, const char *key, guint id)
+{
+	/* The previous query did not see rows added or replaced since. */
+	if (s->key == NULL || strcmp(s->key, key) != 0 ||
+	    s->len_hits != entry_store_len(s->store) ||
+	    s->changes != entry_store_changes(s->store))
+		search_run(s, key);
+
+	return id < s->len_hits && s->hits[id];
+}
+
+/*
+ * Find the rows matching a new query.
+ */
+void
+search_run(struct search *s, const char *key)
+{
+	char		*folded;
+	const char	*blob;
+	guint32		*names, *texts;
+	guint		 i, id, prefixed = 0;
+	size_t		 len;
+	GArray		*cand;
+
+	search_index(s);
+
+	g_free(s->key);
+	s->key = g_strdup(key);
+
+	free(s->hits);
+	s->len_hits = s->texts->len;
+	blob = s->folded->str;
+	names = (guint32 *)s->names->data;
+	texts = (guint32 *)s->texts->data;
+	if ((s->hits = calloc(s->len_hits + 1, sizeof(uint8_t))) == NULL)
+		err(1, NULL);
+
+	folded = search_fold(key);
+	len = strlen(folded);
+	cand = search_candidates(s, folded);
+
+	for (i = 0; i < cand->len; i++) {
+		id = g_array_index(cand, guint, i);
+		if (strncmp(blob + names[id], folded, len) == 0) {
+			s->hits[id] = 1;
+			prefixed++;
+		}
+	}
+
+	if (prefixed == 0)
+		for (i = 0; i < cand->len; i++) {
+			id = g_array_index(cand, guint, i);
+			if (strstr(blob + texts[id], folded))
+				s->hits[id] = 1;
+		}
+
+	g_array_free(cand, TRUE);
+	g_free(folded);
+}
+
+/*
+ * The rows that contain every trigram of the folded query. Queries too short
+ * to have a trigram have every row as a candidate.
+ */
+GArray *
+search_candidates(struct search *s, const char *folded)
+{
+	guint		 i, j, k, n;
+	const char	*p;
+	GArray		*cand, *posting, *shortest = NULL;
+
+	cand = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	if (strlen(folded) < 3) {
+		for (i = 0; i < s->texts->len; i++)
+			g_array_append_val(cand, i);
+		return cand;
+	}
+
+	for (p = folded; p[2]; p++) {
+		posting = g_hash_table_lookup(s->postings,
+		    GUINT_TO_POINTER(search_trigram(p)));
+		if (posting == NULL)
+			return cand;
+		if (shortest == NULL || posting->len < shortest->len)
+			shortest = posting;
+	}
+
+	g_array_append_vals(cand, shortest->data, shortest->len);
+
+	for (p = folded; p[2] && cand->len > 0; p++) {
+		posting = g_hash_table_lookup(s->postings,
+		    GUINT_TO_POINTER(search_trigram(p)));
+		if (posting == shortest)
+			continue;
+
+		/* Both lists are sorted; keep what is in both. */
+		for (i = j = n = 0; i < cand->len && j < posting->len;) {
+			k = g_array_index(posting, guint, j);
+			if (g_array_index(cand, guint, i) < k)
+				i++;
+			else if (g_array_index(cand, guint, i) > k)
+				j++;
+			else {
+				g_array_index(cand, guint, n++) = k;
+				i++;
+				j++;
+			}
+		}
+		g_array_set_size(cand, n);
+	}
+
+	return cand;
+}
+
+/*
+ * Normalize and case-fold a string for comparison.
+ */
+char *
+search_fold(const char *str)
+{
+	char	*norm, *folded;
+
+	if ((norm = g_utf8_normalize(str, -1, G_NORMALIZE_ALL)) == NULL)
+		return g_utf8_casefold(str, -1);
+
+	folded = g_utf8_casefold(norm, -1);
+	g_free(norm);
+	return folded;
+}
+
+/*
+ * Pack the three bytes at p into a key. None of them is NUL, so the key is
+ * never 0.
+ */
+guint32
+search_trigram(const char *p)
+{
+	return (guint32)(unsigned char)p[0] << 16 |
+	    (guint32)(unsigned char)p[1] << 8 | (unsigned char)p[2];
+}
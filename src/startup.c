@@ -0,0 +1,619 @@
+/*
+ * Copyright (c) 2015 Mike Burns <mike@mike-burns.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Startup notification, as in the freedesktop.org Startup Notification
+ * Protocol. Each launch gets a DESKTOP_STARTUP_ID, and is complete when the
+ * application sends the remove message for it or, for applications that only
+ * give a StartupWMClass, maps a window of that class. The time from launching
+ * to completion is appended to a log, which --launch-stats summarizes.
+ *
+ * Launches still pending when bytestream is done are left to a forked child,
+ * which goes on watching on the same X connection, so that bytestream itself
+ * exits straight away without missing anything sent in between.
+ *
+ * This needs X11; on other displays no IDs are handed out.
+ */
+
+#define _BSD_SOURCE 1
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <gtk/gtk.h>
+#ifdef GDK_WINDOWING_X11
+#include <gdk/gdkx.h>
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
+#endif
+
+#include "startup.h"
+#include "compat.h"
+
+#define STARTUP_TIMEOUT	30	/* Seconds before giving up on a launch */
+
+struct startup {
+	char	*id;
+	char	*name;		/* The entry name, for the log */
+	char	*wmclass;	/* StartupWMClass, or NULL */
+	gint64	 spawned;	/* Monotonic time of the launch */
+	guint	 timeout;	/* The timeout source, or 0 */
+};
+
+struct startup_stat {
+	const char	*name;
+	GArray		*times;		/* Completed launches, in microseconds */
+	guint		 timeouts;
+};
+
+#ifdef GDK_WINDOWING_X11
+static void		 startup_watch(GdkDisplay *);
+static GdkFilterReturn	 startup_filter(GdkXEvent *, GdkEvent *, gpointer);
+static void		 startup_message(const char *);
+static char		*startup_message_id(const char *);
+static void		 startup_check_clients(int);
+static void		 startup_free_message(gpointer);
+static gboolean		 startup_timed_out(gpointer);
+static void		 startup_finish(struct startup *, gint64, int);
+static void		 startup_log(const char *, gint64);
+#endif
+static __dead void	 startup_detached(void);
+static void		 startup_wait(void);
+static void		 startup_forget(struct startup *);
+static char		*startup_log_path(void);
+static gint		 startup_compare_times(gconstpointer, gconstpointer);
+static gint		 startup_compare_stats(gconstpointer, gconstpointer);
+static double		 startup_percentile(GArray *, double);
+
+static GList		*pending = NULL;	/* struct startup */
+static int		 waiting = 0;
+#ifdef GDK_WINDOWING_X11
+static int		 watching = 0;
+static GHashTable	*messages = NULL;	/* Window to partial message */
+static GHashTable	*clients = NULL;	/* Windows already mapped */
+static Atom		 atom_begin, atom_info, atom_client_list;
+#endif
+
+/*
+ * Start a launch sequence for the entry, and return the DESKTOP_STARTUP_ID to
+ * pass on to it. Returns NULL if the entry supports neither StartupNotify nor
+ * StartupWMClass, or if the display is not X11.
+ */
+char *
+startup_begin(const char *name, const char *wmclass, int notify)
+{
+#ifdef GDK_WINDOWING_X11
+	char		 screen[16];
+	static guint	 serial = 0;
+	GdkDisplay	*display;
+	struct startup	*s;
+
+	display = gdk_display_get_default();
+	if ((!notify && wmclass == NULL) || display == NULL ||
+	    !GDK_IS_X11_DISPLAY(display))
+		return NULL;
+
+	startup_watch(display);
+
+	s = g_new0(struct startup, 1);
+	s->id = g_strdup_printf("bytestream-%d-%s-%u_TIME%u", (int)getpid(),
+	    g_get_host_name(), ++serial, gtk_get_current_event_time());
+	s->name = g_strdup(name);
+	s->wmclass = g_strdup(wmclass);
+	s->spawned = g_get_monotonic_time();
+	s->timeout = g_timeout_add_seconds(STARTUP_TIMEOUT, startup_timed_out,
+	    s);
+	pending = g_list_prepend(pending, s);
+
+	snprintf(screen, sizeof(screen), "%d", gdk_x11_screen_get_screen_number(
+	    gdk_screen_get_default()));
+	gdk_x11_display_broadcast_startup_message(display, "new",
+	    "ID", s->id,
+	    "NAME", name,
+	    "SCREEN", screen,
+	    wmclass ? "WMCLASS" : NULL, wmclass,
+	    NULL);
+
+	return g_strdup(s->id);
+#else
+	return NULL;
+#endif
+}
+
+/*
+ * Leave the launches that have not completed to a child, so that the caller
+ * can exit straight away. The child inherits the X connection along with the
+ * messages and windows seen so far, so a launch that completes while the
+ * caller exits still gets its real latency. From here on only the child may
+ * use the display; the caller must not make any more X requests.
+ */
+void
+startup_detach(void)
+{
+	/* Take in whatever has already arrived. */
+	while (pending && gtk_events_pending())
+		gtk_main_iteration();
+	if (pending == NULL)
+		return;
+
+	/* Neither process may send the other's half-written requests. */
+	gdk_display_flush(gdk_display_get_default());
+
+	switch (fork()) {
+	case -1:
+		warn("fork");
+		break;
+	case 0:
+		startup_detached();
+		/* NOTREACHED */
+	}
+
+	while (pending)
+		startup_forget(pending->data);
+}
+
+/*
+ * The child of startup_detach(). It has no standard streams, so that scripts
+ * reading the caller's are not held up by it, and it leaves its session so
+ * that it outlives the terminal. Only the thread that forked is left, so
+ * nothing but the main loop's own sources may be relied upon.
+ */
+__dead void
+startup_detached(void)
+{
+	int	fd;
+
+	setsid();
+	if ((fd = open("/dev/null", O_RDWR)) != -1) {
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+
+	startup_wait();
+	_exit(0);
+}
+
+/*
+ * Run the main loop until every launch has completed or timed out.
+ */
+void
+startup_wait(void)
+{
+	if (pending == NULL)
+		return;
+
+	waiting = 1;
+	gtk_main();
+	waiting = 0;
+}
+
+#ifdef GDK_WINDOWING_X11
+/*
+ * Start watching the root window for startup messages and new windows.
+ */
+void
+startup_watch(GdkDisplay *display)
+{
+	GdkWindow	*root;
+
+	if (watching)
+		return;
+	watching = 1;
+
+	atom_begin = gdk_x11_get_xatom_by_name_for_display(display,
+	    "_NET_STARTUP_INFO_BEGIN");
+	atom_info = gdk_x11_get_xatom_by_name_for_display(display,
+	    "_NET_STARTUP_INFO");
+	atom_client_list = gdk_x11_get_xatom_by_name_for_display(display,
+	    "_NET_CLIENT_LIST");
+
+	messages = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
+	    startup_free_message);
+	clients = g_hash_table_new(g_direct_hash, g_direct_equal);
+	startup_check_clients(0);
+
+	root = gdk_get_default_root_window();
+	gdk_window_set_events(root,
+	    gdk_window_get_events(root) | GDK_PROPERTY_CHANGE_MASK);
+
+	/* The messages name the sender's window, not the root. */
+	gdk_window_add_filter(NULL, startup_filter, NULL);
+}
+
+/*
+ * Collect the 20-byte pieces of startup messages, and notice changes to the
+ * list of mapped windows.
+ */
+GdkFilterReturn
+startup_filter(GdkXEvent *gxev, GdkEvent *event, gpointer data)
+{
+	XEvent		*xev = gxev;
+	GString		*msg;
+	gpointer	 key;
+	size_t		 len;
+
+	switch (xev->type) {
+	case ClientMessage:
+		if (xev->xclient.format != 8)
+			break;
+
+		key = GUINT_TO_POINTER(xev->xclient.window);
+		if (xev->xclient.message_type == atom_begin) {
+			msg = g_string_new(NULL);
+			g_hash_table_replace(messages, key, msg);
+		} else if (xev->xclient.message_type == atom_info) {
+			if ((msg = g_hash_table_lookup(messages, key)) == NULL)
+				break;
+		} else
+			break;
+
+		len = strnlen(xev->xclient.data.b, 20);
+		g_string_append_len(msg, xev->xclient.data.b, len);
+		if (len < 20) {
+			startup_message(msg->str);
+			g_hash_table_remove(messages, key);
+		}
+		break;
+	case PropertyNotify:
+		if (xev->xproperty.atom == atom_client_list)
+			startup_check_clients(1);
+		break;
+	default:
+		break;
+	}
+
+	return GDK_FILTER_CONTINUE;
+}
+
+void
+startup_free_message(gpointer msg)
+{
+	g_string_free(msg, TRUE);
+}
+
+/*
+ * Handle a complete startup message: a remove message ends its launch.
+ */
+void
+startup_message(const char *msg)
+{
+	char	*id;
+	GList	*l;
+
+	if (strncmp(msg, "remove:", 7) != 0 ||
+	    (id = startup_message_id(msg + 7)) == NULL)
+		return;
+
+	for (l = pending; l; l = l->next)
+		if (strcmp(((struct startup *)l->data)->id, id) == 0) {
+			startup_finish(l->data, g_get_monotonic_time(), 0);
+			break;
+		}
+
+	g_free(id);
+}
+
+/*
+ * The ID from the KEY=VALUE pairs of a message. Values may be quoted, and
+ * may escape characters with a backslash.
+ */
+char *
+startup_message_id(const char *p)
+{
+	int		 is_id, quoted;
+	GString		*value;
+
+	for (;;) {
+		while (*p == ' ')
+			p++;
+		if (!*p)
+			return NULL;
+
+		is_id = strncmp(p, "ID=", 3) == 0;
+		if ((p = strchr(p, '=')) == NULL)
+			return NULL;
+		p++;
+
+		value = g_string_new(NULL);
+		for (quoted = 0; *p && (quoted || *p != ' '); p++) {
+			if (*p == '"')
+				quoted = !quoted;
+			else if (*p == '\\' && p[1])
+				g_string_append_c(value, *++p);
+			else
+				g_string_append_c(value, *p);
+		}
+
+		if (is_id)
+			return g_string_free(value, FALSE);
+		g_string_free(value, TRUE);
+	}
+}
+
+/*
+ * Look for newly mapped windows whose class is awaited by a launch. When not
+ * matching, only remember the windows that are already there.
+ */
+void
+startup_check_clients(int match)
+{
+	int		 format;
+	GList		*l;
+	Atom		 type;
+	Window		*wins;
+	Display		*xdisplay;
+	XClassHint	 hint;
+	unsigned char	*data = NULL;
+	unsigned long	 i, n, after;
+	struct startup	*s;
+
+	xdisplay = GDK_DISPLAY_XDISPLAY(gdk_display_get_default());
+
+	gdk_x11_display_error_trap_push(gdk_display_get_default());
+	if (XGetWindowProperty(xdisplay, DefaultRootWindow(xdisplay),
+	    atom_client_list, 0, G_MAXLONG, False, XA_WINDOW, &type, &format,
+	    &n, &after, &data) != Success || data == NULL || format != 32) {
+		gdk_x11_display_error_trap_pop_ignored(
+		    gdk_display_get_default());
+		if (data)
+			XFree(data);
+		return;
+	}
+	wins = (Window *)data;
+
+	for (i = 0; i < n; i++) {
+		if (!g_hash_table_add(clients, GUINT_TO_POINTER(wins[i])) ||
+		    !match)
+			continue;
+		if (!XGetClassHint(xdisplay, wins[i], &hint))
+			continue;
+
+		for (l = pending; l; l = l->next) {
+			s = l->data;
+			if (s->wmclass &&
+			    ((hint.res_class &&
+			    g_ascii_strcasecmp(s->wmclass, hint.res_class) == 0) ||
+			    (hint.res_name &&
+			    g_ascii_strcasecmp(s->wmclass, hint.res_name) == 0))) {
+				startup_finish(s, g_get_monotonic_time(), 1);
+				break;
+			}
+		}
+
+		XFree(hint.res_name);
+		XFree(hint.res_class);
+	}
+
+	XFree(data);
+	gdk_x11_display_error_trap_pop_ignored(gdk_display_get_default());
+}
+
+/*
+ * Give up on a launch that has not completed.
+ */
+gboolean
+startup_timed_out(gpointer data)
+{
+	struct startup	*s = data;
+
+	s->timeout = 0;
+	startup_finish(s, -1, 1);
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Log the launch and forget it, first sending the remove message if the
+ * application has not. A completion time of -1 is a timeout.
+ */
+void
+startup_finish(struct startup *s, gint64 completed, int remove)
+{
+	startup_log(s->name, completed < 0 ? -1 : completed - s->spawned);
+
+	if (remove)
+		gdk_x11_display_broadcast_startup_message(
+		    gdk_display_get_default(), "remove", "ID", s->id, NULL);
+
+	startup_forget(s);
+}
+
+/*
+ * Append a launch to the log: the time, the latency in microseconds or -1,
+ * and the entry name, separated by tabs.
+ */
+void
+startup_log(const char *name, gint64 latency)
+{
+	char	*path, *dir;
+	FILE	*fp;
+
+	path = startup_log_path();
+	dir = g_path_get_dirname(path);
+	g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+
+	if ((fp = fopen(path, "a")) == NULL) {
+		warn("%s", path);
+		g_free(path);
+		return;
+	}
+
+	fprintf(fp, "%lld\t%lld\t%s\n", (long long)time(NULL),
+	    (long long)latency, name);
+	if (fclose(fp) != 0)
+		warn("%s", path);
+	g_free(path);
+}
+#endif
+
+/*
+ * Stop waiting for a launch, without logging it.
+ */
+void
+startup_forget(struct startup *s)
+{
+	if (s->timeout)
+		g_source_remove(s->timeout);
+	pending = g_list_remove(pending, s);
+	g_free(s->wmclass);
+	g_free(s->name);
+	g_free(s->id);
+	g_free(s);
+
+	if (waiting && pending == NULL)
+		gtk_main_quit();
+}
+
+/*
+ * The launch log lives in $XDG_STATE_HOME, since it cannot be rebuilt.
+ */
+char *
+startup_log_path(void)
+{
+	const char	*state;
+
+	if ((state = getenv("XDG_STATE_HOME")) != NULL && *state == '/')
+		return g_build_filename(state, "bytestream", "launches", NULL);
+
+	return g_build_filename(g_get_home_dir(), ".local", "state",
+	    "bytestream", "launches", NULL);
+}
+
+/*
+ * Summarize the launch log: for each entry, the median, 90th percentile, and
+ * slowest launch in milliseconds, the number of launches, and the number of
+ * timeouts. The slowest entries come first.
+ */
+int
+startup_stats(void)
+{
+	guint			  i;
+	char			 *path, *contents;
+	gchar			**lines, **fields;
+	gint64			  latency;
+	GHashTable		 *stats;
+	GPtrArray		 *sorted;
+	struct startup_stat	 *st;
+
+	path = startup_log_path();
+	if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+		g_free(path);
+		return 0;
+	}
+	g_free(path);
+
+	stats = g_hash_table_new(g_str_hash, g_str_equal);
+	sorted = g_ptr_array_new();
+	lines = g_strsplit(contents, "\n", -1);
+	g_free(contents);
+
+	for (i = 0; lines[i]; i++) {
+		fields = g_strsplit(lines[i], "\t", 3);
+		if (g_strv_length(fields) != 3) {
+			g_strfreev(fields);
+			continue;
+		}
+
+		if ((st = g_hash_table_lookup(stats, fields[2])) == NULL) {
+			st = g_new0(struct startup_stat, 1);
+			st->name = g_strdup(fields[2]);
+			st->times = g_array_new(FALSE, FALSE, sizeof(gint64));
+			g_hash_table_insert(stats, (gpointer)st->name, st);
+			g_ptr_array_add(sorted, st);
+		}
+
+		latency = g_ascii_strtoll(fields[1], NULL, 10);
+		if (latency < 0)
+			st->timeouts++;
+		else
+			g_array_append_val(st->times, latency);
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+
+	for (i = 0; i < sorted->len; i++)
+		g_array_sort(((struct startup_stat *)
+		    g_ptr_array_index(sorted, i))->times, startup_compare_times);
+	g_ptr_array_sort(sorted, startup_compare_stats);
+
+	printf("%9s %9s %9s %8s %8s  %s\n", "p50_ms", "p90_ms", "max_ms",
+	    "launches", "timeouts", "name");
+	for (i = 0; i < sorted->len; i++) {
+		st = g_ptr_array_index(sorted, i);
+		printf("%9.1f %9.1f %9.1f %8u %8u  %s\n",
+		    startup_percentile(st->times, 0.50),
+		    startup_percentile(st->times, 0.90),
+		    startup_percentile(st->times, 1),
+		    st->times->len + st->timeouts, st->timeouts, st->name);
+
+		g_array_free(st->times, TRUE);
+		g_free((char *)st->name);
+		g_free(st);
+	}
+
+	g_ptr_array_free(sorted, TRUE);
+	g_hash_table_unref(stats);
+
+	return 0;
+}
+
+gint
+startup_compare_times(gconstpointer a, gconstpointer b)
+{
+	gint64	x = *(const gint64 *)a, y = *(const gint64 *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * Slowest median first.
+ */
+gint
+startup_compare_stats(gconstpointer a, gconstpointer b)
+{
+	double	x, y;
+
+	x = startup_percentile((*(struct startup_stat *const *)a)->times, 0.5);
+	y = startup_percentile((*(struct startup_stat *const *)b)->times, 0.5);
+
+	return (x < y) - (x > y);
+}
+
+/*
+ * The q-th quantile of the sorted launch times, in milliseconds.
+ */
+double
+startup_percentile(GArray *times, double q)
+{
+	if (times->len == 0)
+		return 0;
+
+	return g_array_index(times, gint64, (guint)(q * (times->len - 1))) /
+	    1000.0;
+}